@@ -187,17 +187,20 @@ check_domain(char *data, size_t size)
 
 /* 
  * Search for the next www link in data.
+ * These, like the other halink functions, are called for every trigger
+ * character in text, so they don't allocate: on success, the link is
+ * the "rewind_p" bytes before "data" and the returned length after.
+ * Returns zero if there's no link.
  */
 size_t
-halink_www(size_t *rewind_p, struct lowdown_buf *link,
-	char *data, size_t max_rewind, size_t size)
+halink_www(size_t *rewind_p, char *data, size_t max_rewind, size_t size)
 {
 	size_t link_end;
 
-	if (max_rewind > 0 && !ispunct(data[-1]) && !isspace(data[-1]))
+	if (size < 4 || memcmp(data, "www.", strlen("www.")) != 0)
 		return 0;
 
-	if (size < 4 || memcmp(data, "www.", strlen("www.")) != 0)
+	if (max_rewind > 0 && !ispunct(data[-1]) && !isspace(data[-1]))
 		return 0;
 
 	link_end = check_domain(data, size);
@@ -213,7 +216,6 @@ halink_www(size_t *rewind_p, struct lowdown_buf *link,
 	if (link_end == 0)
 		return 0;
 
-	hbuf_put(link, data, link_end);
 	*rewind_p = 0;
 
 	return link_end;
@@ -221,10 +223,10 @@ halink_www(size_t *rewind_p, struct lowdown_buf *link,
 
 /* 
  * Search for the next email in data.
+ * See halink_www().
  */
 size_t
-halink_email(size_t *rewind_p, struct lowdown_buf *link, 
-	char *data, size_t max_rewind, size_t size)
+halink_email(size_t *rewind_p, char *data, size_t max_rewind, size_t size)
 {
 	size_t	 link_end, rewind;
 	int	 nb = 0, np = 0;
@@ -245,15 +247,22 @@ halink_email(size_t *rewind_p, struct lowdown_buf *link,
 	if (rewind == 0)
 		return 0;
 
+	/*
+	 * Neither the rewind above nor this scan may pass another '@',
+	 * so in an unbroken token with many of them, each byte is only
+	 * looked at by the triggers on either side of it.
+	 */
+
 	for (link_end = 0; link_end < size; ++link_end) {
 		c = data[link_end];
 
 		if (isalnum(c))
 			continue;
 
-		if (c == '@')
-			nb++;
-		else if (c == '.' && link_end < size - 1)
+		if (c == '@') {
+			if (++nb > 1)
+				return 0;
+		} else if (c == '.' && link_end < size - 1)
 			np++;
 		else if (c != '-' && c != '_')
 			break;
@@ -268,7 +277,6 @@ halink_email(size_t *rewind_p, struct lowdown_buf *link,
 	if (link_end == 0)
 		return 0;
 
-	hbuf_put(link, data - rewind, link_end + rewind);
 	*rewind_p = rewind;
 
 	return link_end;
@@ -276,10 +284,10 @@ halink_email(size_t *rewind_p, struct lowdown_buf *link,
 
 /* 
  * Search for the next URL in data.
+ * See halink_www().
  */
 size_t
-halink_url(size_t *rewind_p, struct lowdown_buf *link,
-	char *data, size_t max_rewind, size_t size)
+halink_url(size_t *rewind_p, char *data, size_t max_rewind, size_t size)
 {
 	size_t link_end, rewind = 0, domain_len;
 
@@ -308,7 +316,6 @@ halink_url(size_t *rewind_p, struct lowdown_buf *link,
 	if (link_end == 0)
 		return 0;
 
-	hbuf_put(link, data - rewind, link_end + rewind);
 	*rewind_p = rewind;
 
 	return link_end;
@@ -0,0 +1,653 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lowdown.h"
+#include "extern.h"
+#include "bench.h"
+
+/*
+ * Benchmark harness for the parser, the smartypants pass, each of the
+ * renderers, and the difference engine.
+ * It generates a deterministic corpus in memory (no input files), runs
+ * every stage over each document a given number of times, and prints
+ * the results as JSON to standard output.
+ */
+
+enum	stage {
+	STAGE_PARSE,
+	STAGE_SRCPOS,
+	STAGE_INTERN,
+	STAGE_SMARTY,
+	STAGE_HTML,
+	STAGE_TERM,
+	STAGE_MAN,
+	STAGE_MS,
+	STAGE_LATEX,
+	STAGE_GEMINI,
+	STAGE_NULL,
+	STAGE_DIFF,
+	STAGE__MAX
+};
+
+static const char *const stages[STAGE__MAX] = {
+	"parse", /* STAGE_PARSE */
+	"parse-srcpos", /* STAGE_SRCPOS */
+	"parse-intern", /* STAGE_INTERN */
+	"smarty", /* STAGE_SMARTY */
+	"html", /* STAGE_HTML */
+	"term", /* STAGE_TERM */
+	"man", /* STAGE_MAN */
+	"ms", /* STAGE_MS */
+	"latex", /* STAGE_LATEX */
+	"gemini", /* STAGE_GEMINI */
+	"null", /* STAGE_NULL */
+	"diff", /* STAGE_DIFF */
+};
+
+/*
+ * Accumulated results of running one stage over one document.
+ */
+struct	result {
+	uint64_t	 ns; /* total wall-clock nanoseconds */
+	uint64_t	 allocs; /* total allocations */
+	uint64_t	 alloc_bytes; /* total bytes allocated */
+	size_t		 outsz; /* output size of the last run */
+};
+
+typedef void (*genfp)(struct lowdown_buf *, size_t);
+
+static void gen_code(struct lowdown_buf *, size_t);
+static void gen_footnotes(struct lowdown_buf *, size_t);
+static void gen_lists(struct lowdown_buf *, size_t);
+static void gen_nav(struct lowdown_buf *, size_t);
+static void gen_prose(struct lowdown_buf *, size_t);
+static void gen_refs(struct lowdown_buf *, size_t);
+static void gen_tables(struct lowdown_buf *, size_t);
+
+static const struct corpus {
+	const char	*name;
+	genfp		 gen;
+} corpora[] = {
+	{ "prose", gen_prose },
+	{ "tables", gen_tables },
+	{ "lists", gen_lists },
+	{ "refs", gen_refs },
+	{ "footnotes", gen_footnotes },
+	{ "code", gen_code },
+	{ "nav", gen_nav },
+	{ NULL, NULL }
+};
+
+static const char *const words[] = {
+	"the", "of", "markdown", "parser", "node", "tree", "render",
+	"output", "buffer", "lowdown", "document", "block", "span",
+	"quickly", "is", "a", "and", "to", "in", "for", "with",
+	"emphasis", "table", "list", "reference", "footnote", "code",
+	"it's", "\"quoted\"", "(aside)", "and/or", "--", "...",
+	"naïve", "café", "über", "x*y", "a_b", "5 > 3", "AT&T",
+	NULL
+};
+
+/*
+ * Emit a sentence of "nw" random words, with occasional inline markup
+ * (emphasis, code spans, links) to exercise the inline triggers.
+ */
+static void
+gen_sentence(struct lowdown_buf *ob, size_t nw)
+{
+	size_t		 i, nwords;
+	const char	*w;
+
+	for (nwords = 0; words[nwords] != NULL; nwords++)
+		continue;
+
+	for (i = 0; i < nw; i++) {
+		if (i > 0)
+			hbuf_putc(ob, ' ');
+		w = words[bench_rand(nwords)];
+		switch (bench_rand(16)) {
+		case 0:
+			hbuf_printf(ob, "*%s*", w);
+			break;
+		case 1:
+			hbuf_printf(ob, "**%s**", w);
+			break;
+		case 2:
+			hbuf_printf(ob, "`%s`", w);
+			break;
+		case 3:
+			hbuf_printf(ob, "[%s](https://"
+				"example.com/%s/%u)", w, w, bench_rand(1000));
+			break;
+		default:
+			hbuf_puts(ob, w);
+			break;
+		}
+	}
+	HBUF_PUTSL(ob, ".");
+}
+
+static void
+gen_prose(struct lowdown_buf *ob, size_t sz)
+{
+	size_t	 i, j;
+
+	for (i = 0; ob->size < sz; i++) {
+		if (i % 10 == 0) {
+			hbuf_printf(ob, "%.*s Section %zu\n\n",
+				(int)(1 + bench_rand(3)), "###", i / 10);
+			continue;
+		}
+		for (j = 0; j < 3 + bench_rand(5); j++) {
+			if (j > 0)
+				hbuf_putc(ob, ' ');
+			gen_sentence(ob, 5 + bench_rand(20));
+		}
+		HBUF_PUTSL(ob, "\n\n");
+	}
+}
+
+static void
+gen_tables(struct lowdown_buf *ob, size_t sz)
+{
+	size_t	 i, j, cols, rows;
+
+	while (ob->size < sz) {
+		cols = 2 + bench_rand(6);
+		rows = 5 + bench_rand(40);
+		for (j = 0; j < cols; j++)
+			hbuf_printf(ob, "| Head %zu ", j);
+		HBUF_PUTSL(ob, "|\n");
+		for (j = 0; j < cols; j++)
+			switch (bench_rand(4)) {
+			case 0:
+				HBUF_PUTSL(ob, "|:---");
+				break;
+			case 1:
+				HBUF_PUTSL(ob, "|---:");
+				break;
+			case 2:
+				HBUF_PUTSL(ob, "|:---:");
+				break;
+			default:
+				HBUF_PUTSL(ob, "|---");
+				break;
+			}
+		HBUF_PUTSL(ob, "|\n");
+		for (i = 0; i < rows; i++) {
+			for (j = 0; j < cols; j++) {
+				HBUF_PUTSL(ob, "| ");
+				gen_sentence(ob, 1 + bench_rand(4));
+				hbuf_putc(ob, ' ');
+			}
+			HBUF_PUTSL(ob, "|\n");
+		}
+		HBUF_PUTSL(ob, "\n");
+	}
+}
+
+static void
+gen_lists(struct lowdown_buf *ob, size_t sz)
+{
+	size_t	 depth, i, ord;
+
+	while (ob->size < sz) {
+		ord = bench_rand(2);
+		for (depth = 0; depth < 8; depth++)
+			for (i = 0; i < 1 + bench_rand(3); i++) {
+				hbuf_printf(ob, "%*s", (int)(depth * 4), "");
+				if (ord)
+					hbuf_printf(ob, "%zu. ", i + 1);
+				else
+					HBUF_PUTSL(ob, "- ");
+				gen_sentence(ob, 3 + bench_rand(10));
+				hbuf_putc(ob, '\n');
+			}
+		HBUF_PUTSL(ob, "\n");
+	}
+}
+
+static void
+gen_refs(struct lowdown_buf *ob, size_t sz)
+{
+	size_t	 i, j, nrefs = 0;
+
+	while (ob->size < sz / 2) {
+		for (j = 0; j < 4 + bench_rand(4); j++) {
+			gen_sentence(ob, 3 + bench_rand(8));
+			hbuf_printf(ob, " [see %zu][ref%zu] ",
+				nrefs, nrefs);
+			nrefs++;
+		}
+		HBUF_PUTSL(ob, "\n\n");
+	}
+
+	for (i = 0; i < nrefs; i++)
+		hbuf_printf(ob, "[ref%zu]: https://example.com/"
+			"ref/%zu \"Reference %zu\"\n", i, i, i);
+}
+
+/*
+ * Pages of a site each with the same navigation bar and a few links
+ * from a small set, as in generated documentation.
+ */
+static void
+gen_nav(struct lowdown_buf *ob, size_t sz)
+{
+	size_t	 i, j;
+
+	for (i = 0; ob->size < sz; i++) {
+		hbuf_printf(ob, "## Page %zu\n\n", i);
+		for (j = 0; j < 8; j++)
+			hbuf_printf(ob, "%s[%s](https://example.com/"
+				"docs/%s.html \"%s\")", j > 0 ? " | " : "",
+				words[j], words[j], words[j]);
+		HBUF_PUTSL(ob, "\n\n");
+		for (j = 0; j < 3 + bench_rand(4); j++) {
+			gen_sentence(ob, 5 + bench_rand(10));
+			hbuf_printf(ob, " See also [%s](https://example.com/"
+				"docs/%s.html).\n", words[j], words[j]);
+		}
+		HBUF_PUTSL(ob, "\n");
+	}
+}
+
+static void
+gen_footnotes(struct lowdown_buf *ob, size_t sz)
+{
+	size_t	 i, nfoots = 0;
+
+	while (ob->size < sz / 2) {
+		gen_sentence(ob, 8 + bench_rand(12));
+		hbuf_printf(ob, "[^%zu] ", nfoots++);
+		gen_sentence(ob, 4 + bench_rand(12));
+		HBUF_PUTSL(ob, "\n\n");
+	}
+
+	for (i = 0; i < nfoots; i++) {
+		hbuf_printf(ob, "[^%zu]: ", i);
+		gen_sentence(ob, 5 + bench_rand(15));
+		HBUF_PUTSL(ob, "\n\n");
+	}
+}
+
+static void
+gen_code(struct lowdown_buf *ob, size_t sz)
+{
+	size_t	 i, lines;
+
+	while (ob->size < sz) {
+		gen_sentence(ob, 10 + bench_rand(10));
+		HBUF_PUTSL(ob, "\n\n");
+		lines = 5 + bench_rand(30);
+		if (bench_rand(2)) {
+			HBUF_PUTSL(ob, "```c\n");
+			for (i = 0; i < lines; i++)
+				hbuf_printf(ob, "%*sif (a[%zu] < b && "
+					"c > d) return &e;\n",
+					(int)bench_rand(16), "", i);
+			HBUF_PUTSL(ob, "```\n\n");
+		} else {
+			for (i = 0; i < lines; i++)
+				hbuf_printf(ob, "    %*sx = y * %zu; "
+					"/* <tag> & */\n",
+					(int)bench_rand(16), "", i);
+			HBUF_PUTSL(ob, "\n");
+		}
+	}
+}
+
+/*
+ * Produce an "older revision" of the document "in" for the diff stage:
+ * drop some lines, duplicate others, and change words in a few more.
+ */
+static void
+gen_revision(struct lowdown_buf *ob, const struct lowdown_buf *in)
+{
+	const char	*cp, *end, *nl;
+	size_t		 len;
+
+	cp = in->data;
+	end = in->data + in->size;
+	while (cp < end) {
+		if ((nl = memchr(cp, '\n', end - cp)) == NULL)
+			nl = end;
+		else
+			nl++;
+		len = nl - cp;
+		switch (bench_rand(20)) {
+		case 0:
+			break;
+		case 1:
+			hbuf_put(ob, cp, len);
+			hbuf_put(ob, cp, len);
+			break;
+		case 2:
+			HBUF_PUTSL(ob, "Changed ");
+			hbuf_put(ob, cp, len);
+			break;
+		default:
+			hbuf_put(ob, cp, len);
+			break;
+		}
+		cp = nl;
+	}
+}
+
+static struct lowdown_node *
+parse(const struct lowdown_opts *opts,
+	const struct lowdown_buf *in, size_t *maxn)
+{
+	struct lowdown_doc	*doc;
+	struct lowdown_node	*n;
+
+	doc = lowdown_doc_new(opts);
+	n = lowdown_doc_parse(doc, maxn, in->data, in->size);
+	lowdown_doc_free(doc);
+	return n;
+}
+
+/*
+ * Run a renderer of type "t" over "n" once, accumulating into "r".
+ */
+static void
+run_render(const struct lowdown_opts *opts, enum lowdown_type t,
+	struct lowdown_node *n, struct result *r)
+{
+	struct lowdown_opts	 o = *opts;
+	struct lowdown_buf	*ob;
+	void			*arg;
+	uint64_t		 start, a, ab;
+
+	o.type = t;
+	ob = lowdown_buf_new(4096);
+	a = bench_allocs;
+	ab = bench_alloc_bytes;
+	start = bench_now();
+
+	switch (t) {
+	case LOWDOWN_GEMINI:
+		arg = lowdown_gemini_new(&o);
+		lowdown_gemini_rndr(ob, NULL, arg, n);
+		lowdown_gemini_free(arg);
+		break;
+	case LOWDOWN_HTML:
+		arg = lowdown_html_new(&o);
+		lowdown_html_rndr(ob, NULL, arg, n);
+		lowdown_html_free(arg);
+		break;
+	case LOWDOWN_LATEX:
+		arg = lowdown_latex_new(&o);
+		lowdown_latex_rndr(ob, NULL, arg, n);
+		lowdown_latex_free(arg);
+		break;
+	case LOWDOWN_MAN:
+	case LOWDOWN_NROFF:
+		arg = lowdown_nroff_new(&o);
+		lowdown_nroff_rndr(ob, NULL, arg, n);
+		lowdown_nroff_free(arg);
+		break;
+	case LOWDOWN_TERM:
+		arg = lowdown_term_new(&o);
+		lowdown_term_rndr(ob, NULL, arg, n);
+		lowdown_term_free(arg);
+		break;
+	default:
+		abort();
+	}
+
+	r->ns += bench_now() - start;
+	r->allocs += bench_allocs - a;
+	r->alloc_bytes += bench_alloc_bytes - ab;
+	r->outsz = ob->size;
+	lowdown_buf_free(ob);
+}
+
+/*
+ * Run all stages "iters" times over the document "in".
+ * Node counts are taken from the parse so that all stages are
+ * normalised against the same tree.
+ */
+static void
+run_corpus(const struct lowdown_opts *opts, const char *name,
+	const struct lowdown_buf *in, const struct lowdown_buf *old,
+	size_t iters, int first)
+{
+	struct result		 res[STAGE__MAX];
+	struct lowdown_opts	 o = *opts;
+	struct lowdown_node	*n, *nold, *nd;
+	size_t			 i, maxn, maxold, maxd, nodes;
+	char			*ret;
+	size_t			 retsz;
+	uint64_t		 start, a, ab;
+	enum stage		 s;
+	double			 secs;
+
+	memset(res, 0, sizeof(res));
+
+	/* Parse a reference tree for the node count and renderers. */
+
+	n = parse(opts, in, &nodes);
+
+	for (i = 0; i < iters; i++) {
+		/* Parse. */
+
+		a = bench_allocs;
+		ab = bench_alloc_bytes;
+		start = bench_now();
+		nd = parse(opts, in, &maxn);
+		res[STAGE_PARSE].ns += bench_now() - start;
+		res[STAGE_PARSE].allocs += bench_allocs - a;
+		res[STAGE_PARSE].alloc_bytes += bench_alloc_bytes - ab;
+
+		/* Parse again recording node positions. */
+
+		o.feat = opts->feat | LOWDOWN_SRCPOS;
+		a = bench_allocs;
+		ab = bench_alloc_bytes;
+		start = bench_now();
+		nold = parse(&o, in, &maxn);
+		res[STAGE_SRCPOS].ns += bench_now() - start;
+		res[STAGE_SRCPOS].allocs += bench_allocs - a;
+		res[STAGE_SRCPOS].alloc_bytes += bench_alloc_bytes - ab;
+		lowdown_node_free(nold);
+
+		/* Parse again interning link strings. */
+
+		o.feat = opts->feat | LOWDOWN_INTERN;
+		a = bench_allocs;
+		ab = bench_alloc_bytes;
+		start = bench_now();
+		nold = parse(&o, in, &maxn);
+		res[STAGE_INTERN].ns += bench_now() - start;
+		res[STAGE_INTERN].allocs += bench_allocs - a;
+		res[STAGE_INTERN].alloc_bytes += bench_alloc_bytes - ab;
+		lowdown_node_free(nold);
+		o.feat = opts->feat;
+
+		/* Smartypants modifies its tree: use the new one. */
+
+		a = bench_allocs;
+		ab = bench_alloc_bytes;
+		start = bench_now();
+		smarty(nd, maxn, LOWDOWN_HTML);
+		res[STAGE_SMARTY].ns += bench_now() - start;
+		res[STAGE_SMARTY].allocs += bench_allocs - a;
+		res[STAGE_SMARTY].alloc_bytes += bench_alloc_bytes - ab;
+		lowdown_node_free(nd);
+
+		/* Renderers, all over the same tree. */
+
+		run_render(opts, LOWDOWN_HTML, n, &res[STAGE_HTML]);
+		run_render(opts, LOWDOWN_TERM, n, &res[STAGE_TERM]);
+		run_render(opts, LOWDOWN_MAN, n, &res[STAGE_MAN]);
+		run_render(opts, LOWDOWN_NROFF, n, &res[STAGE_MS]);
+		run_render(opts, LOWDOWN_LATEX, n, &res[STAGE_LATEX]);
+		run_render(opts, LOWDOWN_GEMINI, n, &res[STAGE_GEMINI]);
+
+		/*
+		 * The null "renderer" is the full lowdown_buf() path,
+		 * as with -Tnull: parse, then free.
+		 */
+
+		o.type = LOWDOWN_NULL;
+		a = bench_allocs;
+		ab = bench_alloc_bytes;
+		start = bench_now();
+		lowdown_buf(&o, in->data, in->size, &ret, &retsz, NULL);
+		res[STAGE_NULL].ns += bench_now() - start;
+		res[STAGE_NULL].allocs += bench_allocs - a;
+		res[STAGE_NULL].alloc_bytes += bench_alloc_bytes - ab;
+		res[STAGE_NULL].outsz = retsz;
+		free(ret);
+
+		/* Difference of an older revision against this one. */
+
+		nold = parse(opts, old, &maxold);
+		nd = parse(opts, in, &maxn);
+		a = bench_allocs;
+		ab = bench_alloc_bytes;
+		start = bench_now();
+		lowdown_node_free(lowdown_diff(nold, nd, &maxd));
+		res[STAGE_DIFF].ns += bench_now() - start;
+		res[STAGE_DIFF].allocs += bench_allocs - a;
+		res[STAGE_DIFF].alloc_bytes += bench_alloc_bytes - ab;
+		lowdown_node_free(nold);
+		lowdown_node_free(nd);
+	}
+
+	lowdown_node_free(n);
+
+	for (s = 0; s < STAGE__MAX; s++) {
+		secs = res[s].ns / 1e9;
+		printf("%s    {\"corpus\": \"%s\", \"stage\": \"%s\", "
+			"\"bytes\": %zu, \"nodes\": %zu, "
+			"\"iterations\": %zu, \"seconds\": %.6f, "
+			"\"mb_per_s\": %.3f, \"ns_per_node\": %.2f, "
+			"\"allocs\": %.1f, \"alloc_bytes\": %.1f, "
+			"\"output_bytes\": %zu}",
+			first && s == 0 ? "" : ",\n",
+			name, stages[s], in->size, nodes, iters, secs,
+			secs > 0.0 ? (in->size * (double)iters) /
+				(1024.0 * 1024.0) / secs : 0.0,
+			nodes > 0 ?
+				(double)res[s].ns / iters / nodes : 0.0,
+			(double)res[s].allocs / iters,
+			(double)res[s].alloc_bytes / iters,
+			res[s].outsz);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lowdown_opts	 opts;
+	struct lowdown_buf	*in, *old;
+	const char		*er, *only = NULL;
+	size_t			 i, iters = 3, sz = 64;
+	int			 c, first = 1;
+
+	while ((c = getopt(argc, argv, "c:n:s:")) != -1)
+		switch (c) {
+		case 'c':
+			only = optarg;
+			break;
+		case 'n':
+			iters = strtonum(optarg, 1, INT_MAX, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-n: %s", er);
+			break;
+		case 's':
+			sz = strtonum(optarg, 1, INT_MAX, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-s: %s", er);
+			break;
+		default:
+			goto usage;
+		}
+
+	argc -= optind;
+	if (argc != 0)
+		goto usage;
+
+	/* Same defaults as the lowdown(1) utility. */
+
+	memset(&opts, 0, sizeof(struct lowdown_opts));
+	opts.maxdepth = 128;
+	opts.cols = 72;
+	opts.feat = LOWDOWN_FOOTNOTES |
+		LOWDOWN_AUTOLINK |
+		LOWDOWN_TABLES |
+		LOWDOWN_SUPER |
+		LOWDOWN_STRIKE |
+		LOWDOWN_FENCED |
+		LOWDOWN_COMMONMARK |
+		LOWDOWN_DEFLIST |
+		LOWDOWN_IMG_EXT |
+		LOWDOWN_METADATA;
+	opts.oflags =
+		LOWDOWN_HTML_ESCAPE |
+		LOWDOWN_HTML_HEAD_IDS |
+		LOWDOWN_HTML_NUM_ENT |
+		LOWDOWN_HTML_OWASP |
+		LOWDOWN_HTML_SKIP_HTML |
+		LOWDOWN_NROFF_GROFF |
+		LOWDOWN_NROFF_NUMBERED |
+		LOWDOWN_NROFF_SKIP_HTML |
+		LOWDOWN_LATEX_SKIP_HTML |
+		LOWDOWN_LATEX_NUMBERED;
+
+	printf("{\"size_kb\": %zu, \"iterations\": %zu, "
+		"\"results\": [\n", sz, iters);
+
+	for (i = 0; corpora[i].name != NULL; i++) {
+		if (only != NULL && strcmp(only, corpora[i].name))
+			continue;
+		bench_srand(2463534242U);
+		in = hbuf_new(sz * 1024 + 1024);
+		old = hbuf_new(sz * 1024 + 1024);
+		corpora[i].gen(in, sz * 1024);
+		gen_revision(old, in);
+		run_corpus(&opts, corpora[i].name, in, old, iters, first);
+		first = 0;
+		hbuf_free(in);
+		hbuf_free(old);
+		fflush(stdout);
+	}
+
+	puts("\n]}");
+	return EXIT_SUCCESS;
+usage:
+	fprintf(stderr, "usage: %s [-c corpus] "
+		"[-n iterations] [-s kilobytes]\n", getprogname());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,37 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Allocations made (and bytes requested) through the xmalloc() family
+ * since the program started.
+ */
+extern uint64_t	 bench_allocs;
+extern uint64_t	 bench_alloc_bytes;
+
+uint64_t	 bench_now(void);
+uint32_t	 bench_rand(uint32_t);
+void		 bench_srand(uint32_t);
+
+/*
+ * Only defined in diff-bench.o, which lowdown-diffbench links ahead of
+ * liblowdown.a.
+ */
+extern void	(*diff_phase_hook)(enum diff_phase, int);
+
+#endif /* !BENCH_H */
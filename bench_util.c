@@ -0,0 +1,168 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lowdown.h"
+#include "extern.h"
+#include "bench.h"
+
+/*
+ * Support code shared by the benchmark and scaling programs.
+ * This file provides its own xmalloc(), xcalloc(), etc., so that the
+ * linker never pulls xmalloc.o out of liblowdown.a: every allocation
+ * the library makes through these functions is counted here.
+ */
+
+uint64_t	 bench_allocs;
+uint64_t	 bench_alloc_bytes;
+
+/*
+ * State of the pseudo-random generator (xorshift32).
+ */
+static uint32_t	 rnd_state = 2463534242U;
+
+void *
+xmalloc(size_t siz)
+{
+	void	*p;
+
+	if (siz == 0)
+		errx(EXIT_FAILURE, "xmalloc: zero size");
+	if ((p = malloc(siz)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	bench_allocs++;
+	bench_alloc_bytes += siz;
+	return p;
+}
+
+void *
+xcalloc(size_t no, size_t siz)
+{
+	void	*p;
+
+	if (siz == 0 || no == 0)
+		errx(EXIT_FAILURE, "xcalloc: zero size");
+	if ((p = calloc(no, siz)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	bench_allocs++;
+	bench_alloc_bytes += no * siz;
+	return p;
+}
+
+void *
+xrealloc(void *p, size_t sz)
+{
+
+	if ((p = realloc(p, sz)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	bench_allocs++;
+	bench_alloc_bytes += sz;
+	return p;
+}
+
+void *
+xrecallocarray(void *p, size_t old, size_t nm, size_t sz)
+{
+
+	if ((p = recallocarray(p, old, nm, sz)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	bench_allocs++;
+	bench_alloc_bytes += nm * sz;
+	return p;
+}
+
+void *
+xreallocarray(void *p, size_t nm, size_t sz)
+{
+
+	if ((p = reallocarray(p, nm, sz)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	bench_allocs++;
+	bench_alloc_bytes += nm * sz;
+	return p;
+}
+
+char *
+xstrndup(const char *p, size_t sz)
+{
+	char	*pp;
+
+	if ((pp = strndup(p, sz)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	bench_allocs++;
+	bench_alloc_bytes += strlen(pp) + 1;
+	return pp;
+}
+
+char *
+xstrdup(const char *p)
+{
+	char	*pp;
+
+	if ((pp = strdup(p)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	bench_allocs++;
+	bench_alloc_bytes += strlen(pp) + 1;
+	return pp;
+}
+
+uint64_t
+bench_now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Seed the generator: the same seed always gives the same sequence, so
+ * generated inputs are identical between runs and machines.
+ */
+void
+bench_srand(uint32_t seed)
+{
+
+	rnd_state = seed == 0 ? 2463534242U : seed;
+}
+
+/*
+ * Return a pseudo-random number in [0, max).
+ */
+uint32_t
+bench_rand(uint32_t max)
+{
+
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state % max;
+}
@@ -25,6 +25,7 @@
 
 #include <assert.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,6 +34,34 @@
 #include "lowdown.h"
 #include "extern.h"
 
+/*
+ * A string shared by all buffers interned with the same contents in a
+ * table (see hbuf_intern()).
+ * These buffers have their "asize" set to HBUF_SHARED.
+ */
+struct	hstr {
+	struct hstrtab	*tab; /* table or NULL if freed */
+	struct hstr	*next; /* next in hash bin */
+	size_t		 refs; /* buffers sharing this */
+	size_t		 size; /* size of data */
+	uint32_t	 hash; /* hbuf_hash() of data */
+	char		 data[]; /* contents */
+};
+
+/*
+ * Table of interned strings.
+ * It may be shared and is freed when its last user lets it go, but
+ * interned strings outlive it.
+ */
+struct	hstrtab {
+	struct hstr	**bins; /* hash bins */
+	size_t		  binsz; /* number of bins (power of two) */
+	size_t		  strsz; /* number of strings */
+	size_t		  refs; /* users of the table */
+};
+
+static void	hstr_release(struct lowdown_buf *);
+
 static void
 hbuf_init(struct lowdown_buf *buf, size_t unit, int buffer_free)
 {
@@ -47,12 +76,25 @@ hbuf_init(struct lowdown_buf *buf, size_t unit, int buffer_free)
 /*
  * Clone the buffer at "buf" into the one at "v".
  * The storage of "v" is externally managed.
- * This is a deep copy.
+ * This is a deep copy, except that an interned string is shared (see
+ * hbuf_intern()).
  * Always returns a valid pointer to "v".
  */
 struct lowdown_buf *
 hbuf_clone(const struct lowdown_buf *buf, struct lowdown_buf *v)
 {
+	struct hstr	*s;
+
+	if (buf->asize == HBUF_SHARED) {
+		s = (struct hstr *)(buf->data - offsetof(struct hstr, data));
+		s->refs++;
+		v->data = buf->data;
+		v->size = buf->size;
+		v->asize = HBUF_SHARED;
+		v->unit = buf->unit;
+		v->buffer_free = buf->buffer_free;
+		return(v);
+	}
 
 	v->data = NULL;
 	if (buf->size) {
@@ -60,7 +102,7 @@ hbuf_clone(const struct lowdown_buf *buf, struct lowdown_buf *v)
 		memcpy(v->data, buf->data, buf->size);
 	} 
 	v->size = buf->size;
-	v->asize = buf->asize;
+	v->asize = buf->size;
 	v->unit = buf->unit;
 	v->buffer_free = buf->buffer_free;
 	return(v);
@@ -70,6 +112,7 @@ void
 hbuf_truncate(struct lowdown_buf *buf)
 {
 
+	assert(buf->asize != HBUF_SHARED);
 	buf->size = 0;
 }
 
@@ -98,7 +141,8 @@ hbuf_eq(const struct lowdown_buf *buf1, const struct lowdown_buf *buf2)
 {
 
 	return buf1->size == buf2->size &&
-	       memcmp(buf1->data, buf2->data, buf1->size) == 0;
+	       (buf1->data == buf2->data ||
+	        memcmp(buf1->data, buf2->data, buf1->size) == 0);
 }
 
 /* 
@@ -126,6 +170,161 @@ lowdown_buf_new(size_t unit)
 	return hbuf_new(unit);
 }
 
+/*
+ * FNV-1a hash of "data".
+ */
+uint32_t
+hbuf_hash(const char *data, size_t size)
+{
+	uint32_t	 h = 2166136261U;
+	size_t		 i;
+
+	for (i = 0; i < size; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Allocate a table of interned strings with one user.
+ */
+struct hstrtab *
+hstrtab_new(void)
+{
+	struct hstrtab	*tab;
+
+	tab = xcalloc(1, sizeof(struct hstrtab));
+	tab->binsz = 64;
+	tab->bins = xcalloc(tab->binsz, sizeof(struct hstr *));
+	tab->refs = 1;
+	return tab;
+}
+
+/*
+ * Add a user to the table, returning it.
+ */
+struct hstrtab *
+hstrtab_ref(struct hstrtab *tab)
+{
+
+	tab->refs++;
+	return tab;
+}
+
+/*
+ * Remove a user from the table, freeing it if it was the last.
+ * Strings still in use are detached and freed with their last buffer.
+ */
+void
+hstrtab_free(struct hstrtab *tab)
+{
+	struct hstr	*s, *next;
+	size_t		 i;
+
+	if (tab == NULL || --tab->refs > 0)
+		return;
+
+	for (i = 0; i < tab->binsz; i++)
+		for (s = tab->bins[i]; s != NULL; s = next) {
+			next = s->next;
+			s->tab = NULL;
+			s->next = NULL;
+		}
+
+	free(tab->bins);
+	free(tab);
+}
+
+/*
+ * Double the number of bins in "tab".
+ */
+static void
+hstrtab_grow(struct hstrtab *tab)
+{
+	struct hstr	**bins, *s, *next;
+	size_t		  i, binsz = tab->binsz * 2;
+
+	bins = xcalloc(binsz, sizeof(struct hstr *));
+	for (i = 0; i < tab->binsz; i++)
+		for (s = tab->bins[i]; s != NULL; s = next) {
+			next = s->next;
+			s->next = bins[s->hash & (binsz - 1)];
+			bins[s->hash & (binsz - 1)] = s;
+		}
+
+	free(tab->bins);
+	tab->bins = bins;
+	tab->binsz = binsz;
+}
+
+/*
+ * Set "buf" to the string "data" of "size" bytes interned in "tab",
+ * adding it if not already there.
+ * Buffers sharing a string have equal data pointers and must not be
+ * modified: writing to one trips an assertion.
+ * Like a copied buffer, "buf" is released with hbuf_free().
+ */
+void
+hbuf_intern(struct hstrtab *tab, struct lowdown_buf *buf,
+	const char *data, size_t size)
+{
+	struct hstr	*s;
+	uint32_t	 hash;
+
+	memset(buf, 0, sizeof(struct lowdown_buf));
+	if (size == 0)
+		return;
+
+	hash = hbuf_hash(data, size);
+	for (s = tab->bins[hash & (tab->binsz - 1)]; s != NULL; s = s->next)
+		if (s->hash == hash && s->size == size &&
+		    memcmp(s->data, data, size) == 0)
+			break;
+
+	if (s == NULL) {
+		if (tab->strsz >= tab->binsz)
+			hstrtab_grow(tab);
+		s = xmalloc(sizeof(struct hstr) + size);
+		s->tab = tab;
+		s->refs = 0;
+		s->size = size;
+		s->hash = hash;
+		memcpy(s->data, data, size);
+		s->next = tab->bins[hash & (tab->binsz - 1)];
+		tab->bins[hash & (tab->binsz - 1)] = s;
+		tab->strsz++;
+	}
+
+	s->refs++;
+	buf->data = s->data;
+	buf->size = size;
+	buf->asize = HBUF_SHARED;
+}
+
+/*
+ * Let go of the interned string of "buf", freeing it (and taking it out
+ * of its table) if "buf" was its last user.
+ */
+static void
+hstr_release(struct lowdown_buf *buf)
+{
+	struct hstr	*s, **pp;
+
+	s = (struct hstr *)(buf->data - offsetof(struct hstr, data));
+	if (--s->refs > 0)
+		return;
+
+	if (s->tab != NULL) {
+		pp = &s->tab->bins[s->hash & (s->tab->binsz - 1)];
+		while (*pp != s)
+			pp = &(*pp)->next;
+		*pp = s->next;
+		s->tab->strsz--;
+	}
+	free(s);
+}
+
 /* 
  * Free the buffer.
  * Passing NULL is a noop.
@@ -136,7 +335,10 @@ hbuf_free(struct lowdown_buf *buf)
 	if (NULL == buf) 
 		return;
 
-	free(buf->data);
+	if (buf->asize == HBUF_SHARED)
+		hstr_release(buf);
+	else
+		free(buf->data);
 
 	if (buf->buffer_free)
 		free(buf);
@@ -167,6 +369,7 @@ hbuf_grow(struct lowdown_buf *buf, size_t neosz)
 	 * useless micro optimisation.
 	 */
 	assert(buf && buf->unit);
+	assert(buf->asize != HBUF_SHARED);
 
 	if (buf->asize >= neosz)
 		return;
@@ -198,6 +401,7 @@ void
 hbuf_put(struct lowdown_buf *buf, const char *data, size_t size)
 {
 	assert(buf && buf->unit);
+	assert(buf->asize != HBUF_SHARED);
 
 	if (data == NULL || size == 0)
 		return;
@@ -231,6 +435,7 @@ void
 hbuf_putc(struct lowdown_buf *buf, char c)
 {
 	assert(buf && buf->unit);
+	assert(buf->asize != HBUF_SHARED);
 
 	if (buf->size >= buf->asize)
 		hbuf_grow(buf, buf->size + 1);
@@ -239,6 +444,44 @@ hbuf_putc(struct lowdown_buf *buf, char c)
 	buf->size += 1;
 }
 
+/*
+ * Append the decimal representation of "v" to a buffer.
+ * This is much cheaper than hbuf_printf() with "%zu".
+ */
+void
+hbuf_putu(struct lowdown_buf *buf, uint64_t v)
+{
+	char	 tmp[20], *cp = tmp + sizeof(tmp);
+
+	do
+		*--cp = '0' + v % 10;
+	while ((v /= 10) > 0);
+
+	hbuf_put(buf, cp, tmp + sizeof(tmp) - cp);
+}
+
+/*
+ * Append the upper-case hexadecimal representation of "v" to a buffer,
+ * zero-padded to at least "digits" digits (at most 16).
+ * This is much cheaper than hbuf_printf() with "%.2X" and the like.
+ */
+void
+hbuf_putx(struct lowdown_buf *buf, uint64_t v, size_t digits)
+{
+	static const char	 hex[] = "0123456789ABCDEF";
+	char			 tmp[16], *cp = tmp + sizeof(tmp);
+
+	assert(digits <= sizeof(tmp));
+
+	do
+		*--cp = hex[v & 0xf];
+	while ((v >>= 4) > 0);
+	while ((size_t)(tmp + sizeof(tmp) - cp) < digits)
+		*--cp = '0';
+
+	hbuf_put(buf, cp, tmp + sizeof(tmp) - cp);
+}
+
 /* 
  * Read from a file and append to a buffer, until EOF or error.
  * Returns ferror(3).
@@ -266,6 +509,7 @@ hbuf_printf(struct lowdown_buf *buf, const char *fmt, ...)
 	int n;
 
 	assert(buf && buf->unit);
+	assert(buf->asize != HBUF_SHARED);
 
 	if (buf->size >= buf->asize)
 		hbuf_grow(buf, buf->size + 1);
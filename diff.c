@@ -115,6 +115,30 @@ static	const char *const names[LOWDOWN__MAX] = {
 };
 #endif
 
+#if LOWDOWN_BENCH
+/*
+ * If not NULL, invoked as each phase of lowdown_diff() starts (with
+ * non-zero "start") and finishes.
+ * This only exists in the copy of this file compiled for
+ * lowdown-diffbench(1), never in liblowdown.
+ */
+void	(*diff_phase_hook)(enum diff_phase, int) = NULL;
+#endif
+
+static void
+diff_phase(enum diff_phase phase, int start)
+{
+
+	if (start)
+		LOWDOWN_PROBE1(diff__phase__start, phase);
+	else
+		LOWDOWN_PROBE1(diff__phase__done, phase);
+#if LOWDOWN_BENCH
+	if (diff_phase_hook != NULL)
+		diff_phase_hook(phase, start);
+#endif
+}
+
 static void
 MD5Updatebuf(MD5_CTX *ctx, const struct lowdown_buf *v)
 {
@@ -172,7 +196,7 @@ assign_sigs(MD5_CTX *parent, struct xmap *map,
 	MD5Updatev(&ctx, &n->type, sizeof(enum lowdown_rndrt));
 
 	v = 0.0;
-	TAILQ_FOREACH(nn, &n->children, entries)
+	TAILQ_FOREACH(nn, lowdown_node_children(n), entries)
 		v += assign_sigs(&ctx, map, nn);
 
 	/* Re-assign "xn": child might have reallocated. */
@@ -579,7 +603,16 @@ match_down(struct xnode *xnew, struct xmap *xnewmap,
 		assert(NULL != nold);
 		xnew = &xnewmap->nodes[nnew->id];
 		xold = &xoldmap->nodes[nold->id];
-		match_down(xnew, xnewmap, xold, xoldmap);
+
+		/*
+		 * The old subtree may already have been partially
+		 * matched by a smaller, earlier-processed new subtree
+		 * with the same signature (e.g., a repeated line).
+		 * Don't steal that match: leave this pair unmatched.
+		 */
+
+		if (NULL == xold->match)
+			match_down(xnew, xnewmap, xold, xoldmap);
 		nnew = TAILQ_NEXT(nnew, entries);
 		nold = TAILQ_NEXT(nold, entries);
 	}
@@ -701,7 +734,7 @@ node_clonetree(const struct lowdown_node *v, size_t *id)
 	struct lowdown_node *n, *nn;
 	const struct lowdown_node *vv;
 
-	n = node_clone(v, *id++);
+	n = node_clone(v, (*id)++);
 
 	TAILQ_FOREACH(vv, &v->children, entries) {
 		nn = node_clonetree(vv, id);
@@ -810,7 +843,13 @@ node_word_cmp(const void *p1, const void *p2)
 	return 0 == strncmp(l1->buf, l2->buf, l1->bufsz);
 }
 
-static void
+/*
+ * Run the word-wise LCS algorithm on text nodes "nold" and "nnew",
+ * appending the result to "n".
+ * Returns zero (and does nothing) if either node has no words, e.g.,
+ * consists only of white-space; otherwise returns non-zero.
+ */
+static int
 node_lcs(const struct lowdown_node *nold,
 	const struct lowdown_node *nnew,
 	struct lowdown_node *n, size_t *id)
@@ -824,6 +863,8 @@ node_lcs(const struct lowdown_node *nold,
 
 	newtoksz = node_countwords(nnew);
 	oldtoksz = node_countwords(nold);
+	if (0 == newtoksz || 0 == oldtoksz)
+		return 0;
 
 	newtok = xcalloc(newtoksz, sizeof(struct sesnode));
 	oldtok = xcalloc(oldtoksz, sizeof(struct sesnode));
@@ -883,6 +924,7 @@ node_lcs(const struct lowdown_node *nold,
 	free(oldtok);
 	free(newtokbuf);
 	free(oldtokbuf);
+	return 1;
 }
 
 /*
@@ -975,8 +1017,8 @@ node_merge(const struct lowdown_node *nold,
 		    LOWDOWN_NORMAL_TEXT == nold->type &&
 		    NULL == xold->match &&
 		    LOWDOWN_NORMAL_TEXT == nnew->type &&
-		    NULL == xnew->match) {
-			node_lcs(nold, nnew, n, id);
+		    NULL == xnew->match &&
+		    node_lcs(nold, nnew, n, id)) {
 			nold = TAILQ_NEXT(nold, entries);
 			nnew = TAILQ_NEXT(nnew, entries);
 		}
@@ -1301,11 +1343,14 @@ lowdown_diff(const struct lowdown_node *nold,
 	 * See "Phase 2", sec 5.2.
 	 */
 
+	diff_phase(DIFF_PHASE_SIGS, 1);
 	(void)assign_sigs(NULL, &xoldmap, nold);
 	(void)assign_sigs(NULL, &xnewmap, nnew);
+	diff_phase(DIFF_PHASE_SIGS, 0);
 
 	/* Prime the priority queue with the root. */
 
+	diff_phase(DIFF_PHASE_MATCH, 1);
 	pqueue(nnew, &xnewmap, &pq);
 
 	/* 
@@ -1369,14 +1414,18 @@ lowdown_diff(const struct lowdown_node *nold,
 			&xoldmap.nodes[xnew->optmatch->id], &xoldmap);
 	}
 
+	diff_phase(DIFF_PHASE_MATCH, 0);
+
 	/*
 	 * All nodes have been processed.
 	 * Now we need to optimise, so run a "Phase 4", sec. 5.2.
 	 * Our optimisation is nothing like the paper's.
 	 */
 
+	diff_phase(DIFF_PHASE_OPTIMISE, 1);
 	node_optimise_topdown(nnew, &xnewmap, &xoldmap);
 	node_optimise_bottomup(nnew, &xnewmap, &xoldmap);
+	diff_phase(DIFF_PHASE_OPTIMISE, 0);
 
 #if DEBUG
 	node_print(nnew, &xnewmap, 0);
@@ -1389,8 +1438,10 @@ lowdown_diff(const struct lowdown_node *nold,
 	 * See "Phase 5", sec. 5.2.
 	 */
 
+	diff_phase(DIFF_PHASE_MERGE, 1);
 	i = 0;
 	comp = node_merge(nold, &xoldmap, nnew, &xnewmap, &i);
+	diff_phase(DIFF_PHASE_MERGE, 0);
 
 	*maxn = xnewmap.maxid > xoldmap.maxid ?
 		xnewmap.maxid + 1 :
@@ -0,0 +1,479 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+#include <sys/resource.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lowdown.h"
+#include "extern.h"
+#include "bench.h"
+
+/*
+ * Benchmark of lowdown_diff() over revision histories.
+ * A base document is generated for each size, then a chain of
+ * revisions is derived from it by a deterministic mutator (insertions,
+ * deletions, moves, rewording, section reordering).
+ * Each revision is compared against its predecessor, as when replaying
+ * a history, and the time of each diff phase, allocations, peak memory,
+ * and output size are printed as JSON.
+ */
+
+/*
+ * A document is an array of blocks, each a header, paragraph, list, or
+ * code block with its trailing blank line.
+ */
+struct	doc {
+	char		**blocks;
+	size_t		  blocksz;
+};
+
+enum	mut {
+	MUT_INSERT,
+	MUT_DELETE,
+	MUT_MOVE,
+	MUT_REWORD,
+	MUT_REORDER,
+	MUT__MAX
+};
+
+static const char *const words[] = {
+	"the", "of", "markdown", "parser", "node", "tree", "render",
+	"output", "buffer", "lowdown", "document", "block", "span",
+	"quickly", "is", "a", "and", "to", "in", "for", "with",
+	"emphasis", "table", "list", "reference", "footnote", "code",
+	"*stressed*", "`literal`", "[link](https://bsd.lv)",
+	NULL
+};
+
+/*
+ * Accumulated nanoseconds and start time of each phase, filled in by
+ * phase_hook() during lowdown_buf_diff().
+ */
+static uint64_t	 phase_ns[DIFF_PHASE__MAX];
+static uint64_t	 phase_start[DIFF_PHASE__MAX];
+
+static void
+phase_hook(enum diff_phase phase, int start)
+{
+
+	if (start)
+		phase_start[phase] = bench_now();
+	else
+		phase_ns[phase] += bench_now() - phase_start[phase];
+}
+
+static void
+gen_sentences(struct lowdown_buf *ob, size_t ns)
+{
+	size_t	 i, j, nw, nwords;
+
+	for (nwords = 0; words[nwords] != NULL; nwords++)
+		continue;
+
+	for (i = 0; i < ns; i++) {
+		if (i > 0)
+			hbuf_putc(ob, ' ');
+		nw = 4 + bench_rand(12);
+		for (j = 0; j < nw; j++) {
+			if (j > 0)
+				hbuf_putc(ob, ' ');
+			hbuf_puts(ob, words[bench_rand(nwords)]);
+		}
+		hbuf_putc(ob, '.');
+	}
+}
+
+/*
+ * Generate a new block of random type.
+ * If "header" is non-zero, generate a section header.
+ */
+static char *
+gen_block(int header)
+{
+	struct lowdown_buf	*ob;
+	char			*cp;
+	size_t			 i, n;
+
+	ob = hbuf_new(256);
+
+	if (header) {
+		HBUF_PUTSL(ob, "## ");
+		gen_sentences(ob, 1);
+	} else
+		switch (bench_rand(6)) {
+		case 0:
+			n = 2 + bench_rand(5);
+			for (i = 0; i < n; i++) {
+				HBUF_PUTSL(ob, "- ");
+				gen_sentences(ob, 1);
+				hbuf_putc(ob, '\n');
+			}
+			break;
+		case 1:
+			HBUF_PUTSL(ob, "```\n");
+			n = 2 + bench_rand(8);
+			for (i = 0; i < n; i++)
+				hbuf_printf(ob, "x[%zu] = y;\n", i);
+			HBUF_PUTSL(ob, "```\n");
+			break;
+		default:
+			gen_sentences(ob, 2 + bench_rand(6));
+			break;
+		}
+
+	HBUF_PUTSL(ob, "\n\n");
+	cp = xstrndup(ob->data, ob->size);
+	hbuf_free(ob);
+	return cp;
+}
+
+static void
+doc_insert(struct doc *d, size_t pos, char *block)
+{
+
+	d->blocks = xreallocarray
+		(d->blocks, d->blocksz + 1, sizeof(char *));
+	memmove(&d->blocks[pos + 1], &d->blocks[pos],
+		(d->blocksz - pos) * sizeof(char *));
+	d->blocks[pos] = block;
+	d->blocksz++;
+}
+
+static char *
+doc_remove(struct doc *d, size_t pos)
+{
+	char	*cp = d->blocks[pos];
+
+	memmove(&d->blocks[pos], &d->blocks[pos + 1],
+		(d->blocksz - pos - 1) * sizeof(char *));
+	d->blocksz--;
+	return cp;
+}
+
+static void
+doc_free(struct doc *d)
+{
+	size_t	 i;
+
+	for (i = 0; i < d->blocksz; i++)
+		free(d->blocks[i]);
+	free(d->blocks);
+	d->blocks = NULL;
+	d->blocksz = 0;
+}
+
+static void
+doc_clone(struct doc *dst, const struct doc *src)
+{
+	size_t	 i;
+
+	dst->blocksz = src->blocksz;
+	dst->blocks = xcalloc(src->blocksz, sizeof(char *));
+	for (i = 0; i < src->blocksz; i++)
+		dst->blocks[i] = xstrdup(src->blocks[i]);
+}
+
+static void
+doc_serialise(struct lowdown_buf *ob, const struct doc *d)
+{
+	size_t	 i;
+
+	hbuf_truncate(ob);
+	for (i = 0; i < d->blocksz; i++)
+		hbuf_puts(ob, d->blocks[i]);
+}
+
+/*
+ * Generate a base document of about "sz" bytes: sections of a header
+ * followed by several blocks.
+ */
+static void
+doc_gen(struct doc *d, size_t sz)
+{
+	size_t	 have = 0, i;
+
+	for (i = 0; have < sz; i++) {
+		doc_insert(d, d->blocksz, gen_block(i % 8 == 0));
+		have += strlen(d->blocks[d->blocksz - 1]);
+	}
+}
+
+/*
+ * Replace a few words of block "pos" with others.
+ */
+static void
+doc_reword(struct doc *d, size_t pos)
+{
+	struct lowdown_buf	*ob;
+	const char		*cp, *sp;
+	size_t			 nwords;
+
+	for (nwords = 0; words[nwords] != NULL; nwords++)
+		continue;
+
+	ob = hbuf_new(256);
+	for (cp = d->blocks[pos]; *cp != '\0'; cp = sp) {
+		if ((sp = strchr(cp, ' ')) == NULL) {
+			hbuf_puts(ob, cp);
+			break;
+		}
+		sp++;
+		if (bench_rand(8) == 0) {
+			hbuf_puts(ob, words[bench_rand(nwords)]);
+			hbuf_putc(ob, ' ');
+		} else
+			hbuf_put(ob, cp, sp - cp);
+	}
+	free(d->blocks[pos]);
+	d->blocks[pos] = xstrndup(ob->data, ob->size);
+	hbuf_free(ob);
+}
+
+/*
+ * Swap the section starting at header block "pos" with the following
+ * section, if any.
+ */
+static void
+doc_reorder(struct doc *d, size_t pos)
+{
+	size_t	 a, b, c, i;
+	char	**tmp;
+
+	/* Find [a, b) and [b, c) as consecutive sections. */
+
+	for (a = pos; a > 0; a--)
+		if (strncmp(d->blocks[a], "## ", 3) == 0)
+			break;
+	for (b = a + 1; b < d->blocksz; b++)
+		if (strncmp(d->blocks[b], "## ", 3) == 0)
+			break;
+	if (b == d->blocksz)
+		return;
+	for (c = b + 1; c < d->blocksz; c++)
+		if (strncmp(d->blocks[c], "## ", 3) == 0)
+			break;
+
+	tmp = xcalloc(c - a, sizeof(char *));
+	for (i = 0; i < c - b; i++)
+		tmp[i] = d->blocks[b + i];
+	for (i = 0; i < b - a; i++)
+		tmp[c - b + i] = d->blocks[a + i];
+	memcpy(&d->blocks[a], tmp, (c - a) * sizeof(char *));
+	free(tmp);
+}
+
+/*
+ * Apply "n" random mutations to "d".
+ */
+static void
+doc_mutate(struct doc *d, size_t n)
+{
+	size_t	 i, pos;
+	char	*cp;
+
+	for (i = 0; i < n; i++) {
+		pos = bench_rand(d->blocksz);
+		switch (bench_rand(MUT__MAX)) {
+		case MUT_INSERT:
+			doc_insert(d, pos, gen_block(0));
+			break;
+		case MUT_DELETE:
+			if (d->blocksz > 1)
+				free(doc_remove(d, pos));
+			break;
+		case MUT_MOVE:
+			cp = doc_remove(d, pos);
+			doc_insert(d, bench_rand(d->blocksz + 1), cp);
+			break;
+		case MUT_REWORD:
+			doc_reword(d, pos);
+			break;
+		case MUT_REORDER:
+			doc_reorder(d, pos);
+			break;
+		default:
+			abort();
+		}
+	}
+}
+
+/*
+ * Peak resident set size of the process in kilobytes.
+ */
+static long
+peak_rss(void)
+{
+	struct rusage	 ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		err(EXIT_FAILURE, "getrusage");
+#if defined(__APPLE__)
+	return ru.ru_maxrss / 1024;
+#else
+	return ru.ru_maxrss;
+#endif
+}
+
+/*
+ * Run a revision chain of "revs" revisions on a base document of "kb"
+ * kilobytes.
+ */
+static void
+run_size(const struct lowdown_opts *opts, size_t kb,
+	size_t revs, int *first)
+{
+	struct doc		 prev, cur;
+	struct lowdown_buf	*old, *new;
+	size_t			 i, rsz;
+	uint64_t		 start, total, a, ab;
+	enum diff_phase		 p;
+	char			*ret;
+
+	memset(&prev, 0, sizeof(struct doc));
+	old = hbuf_new(kb * 1024 + 1024);
+	new = hbuf_new(kb * 1024 + 1024);
+
+	bench_srand(2463534242U + kb);
+	doc_gen(&prev, kb * 1024);
+
+	for (i = 1; i <= revs; i++) {
+		doc_clone(&cur, &prev);
+		doc_mutate(&cur, 1 + cur.blocksz / 20);
+		doc_serialise(old, &prev);
+		doc_serialise(new, &cur);
+
+		memset(phase_ns, 0, sizeof(phase_ns));
+		a = bench_allocs;
+		ab = bench_alloc_bytes;
+		start = bench_now();
+		lowdown_buf_diff(opts, new->data, new->size,
+			old->data, old->size, &ret, &rsz, NULL);
+		total = bench_now() - start;
+		a = bench_allocs - a;
+		ab = bench_alloc_bytes - ab;
+		free(ret);
+
+		printf("%s    {\"size_kb\": %zu, \"revision\": %zu, "
+			"\"old_bytes\": %zu, \"new_bytes\": %zu, ",
+			*first ? "" : ",\n", kb, i, old->size, new->size);
+		for (p = 0; p < DIFF_PHASE__MAX; p++)
+			printf("\"%s_ns\": %llu, ",
+				p == DIFF_PHASE_SIGS ? "sigs" :
+				p == DIFF_PHASE_MATCH ? "match" :
+				p == DIFF_PHASE_OPTIMISE ? "optimise" :
+				"merge",
+				(unsigned long long)phase_ns[p]);
+		printf("\"total_ns\": %llu, \"allocs\": %llu, "
+			"\"alloc_bytes\": %llu, \"peak_rss_kb\": %ld, "
+			"\"output_bytes\": %zu}",
+			(unsigned long long)total,
+			(unsigned long long)a,
+			(unsigned long long)ab, peak_rss(), rsz);
+		*first = 0;
+		fflush(stdout);
+
+		doc_free(&prev);
+		prev = cur;
+	}
+
+	doc_free(&prev);
+	hbuf_free(old);
+	hbuf_free(new);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lowdown_opts	 opts;
+	const char		*er;
+	size_t			 i, kb = 16, revs = 6, sizes = 4;
+	int			 c, first = 1;
+
+	while ((c = getopt(argc, argv, "n:r:s:")) != -1)
+		switch (c) {
+		case 'n':
+			sizes = strtonum(optarg, 1, 16, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-n: %s", er);
+			break;
+		case 'r':
+			revs = strtonum(optarg, 1, INT_MAX, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-r: %s", er);
+			break;
+		case 's':
+			kb = strtonum(optarg, 1, INT_MAX / 1024, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-s: %s", er);
+			break;
+		default:
+			goto usage;
+		}
+
+	if (argc != optind)
+		goto usage;
+
+	/* Same defaults as lowdown-diff(1). */
+
+	memset(&opts, 0, sizeof(struct lowdown_opts));
+	opts.type = LOWDOWN_HTML;
+	opts.maxdepth = 128;
+	opts.feat = LOWDOWN_FOOTNOTES |
+		LOWDOWN_AUTOLINK |
+		LOWDOWN_TABLES |
+		LOWDOWN_SUPER |
+		LOWDOWN_STRIKE |
+		LOWDOWN_FENCED |
+		LOWDOWN_COMMONMARK |
+		LOWDOWN_DEFLIST |
+		LOWDOWN_IMG_EXT |
+		LOWDOWN_METADATA;
+	opts.oflags =
+		LOWDOWN_HTML_ESCAPE |
+		LOWDOWN_HTML_HEAD_IDS |
+		LOWDOWN_HTML_NUM_ENT |
+		LOWDOWN_HTML_OWASP |
+		LOWDOWN_HTML_SKIP_HTML |
+		LOWDOWN_SMARTY;
+
+	diff_phase_hook = phase_hook;
+
+	/* Sizes double, so the peak memory is that of the last. */
+
+	printf("{\"revisions\": %zu, \"results\": [\n", revs);
+	for (i = 0; i < sizes; i++)
+		run_size(&opts, kb << i, revs, &first);
+	puts("\n]}");
+	return EXIT_SUCCESS;
+usage:
+	fprintf(stderr, "usage: %s [-n sizes] [-r revisions] "
+		"[-s kilobytes]\n", getprogname());
+	return EXIT_FAILURE;
+}
@@ -28,6 +28,7 @@
 #if HAVE_ERR
 # include <err.h>
 #endif
+#include <limits.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -68,6 +69,8 @@ struct link_ref {
 	struct lowdown_buf	*name; /* identifier of link (or NULL) */
 	struct lowdown_buf	*link; /* link address */
 	struct lowdown_buf	*title; /* optional title */
+	uint32_t		 hash; /* hbuf_hash() of name */
+	struct link_ref		*next; /* next in hash bin */
 	TAILQ_ENTRY(link_ref)	 entries;
 };
 
@@ -81,14 +84,96 @@ struct footnote_ref {
 	size_t		 	 num; /* if referenced, the order */
 	struct lowdown_buf	*name; /* identifier (or NULL) */
 	struct lowdown_buf	*contents; /* contents of footnote */
+	struct srcmap		*map; /* LOWDOWN_SRCPOS map (or NULL) */
 	TAILQ_ENTRY(footnote_ref) entries;
 };
 
 TAILQ_HEAD(footnote_refq, footnote_ref);
 
+/*
+ * Size of the block-level HTML tag hash table.
+ * See hhtml_find_block().
+ */
+#define	BLOCKTAG_MAX	85
+
+/*
+ * NUL padding after an inline span copied by pushspan().
+ */
+#define	SPAN_SLACK	8
+
+/*
+ * Position of the next character at or after any position in [from,
+ * next] of an inline span ending at "end", with "next" being "end" if
+ * there's none.
+ * See find_chr().
+ */
+struct	chr_memo {
+	const char	*from;
+	const char	*next;
+	const char	*end;
+};
+
+/*
+ * Characters remembered with find_chr() in the current inline span.
+ */
+struct	span_memo {
+	struct chr_memo	 gt; /* next '>' */
+	struct chr_memo	 rbrack; /* next ']' */
+	struct chr_memo	 rparen; /* next ')' */
+};
+
+/*
+ * Records that there is no closing tag for a block-level HTML tag at or
+ * after "from" in the buffer being parsed by the parse_block()
+ * invocation "gen".
+ */
+struct	htmlblock_noend {
+	size_t		 gen; /* parse_block() invocation */
+	const char	*from; /* no closing tag from here */
+};
+
+/*
+ * Inline content of a node left unparsed with LOWDOWN_LAZY, parsed by
+ * lowdown_node_children().
+ */
+struct	lowdown_lazy {
+	struct lowdown_buf	 text; /* raw inline span */
+	struct lowdown_doc	*doc; /* parser */
+};
+
+/*
+ * Span of a buffer built from "src", which is in the buffer it was
+ * built from or the input document.
+ * If "srcsz" is zero, the span was expanded from the byte at "src"
+ * (a tab or newline).
+ */
+struct	srcseg {
+	size_t		 off; /* offset in buffer */
+	const char	*src; /* start of source */
+	size_t		 srcsz; /* source length (or zero) */
+};
+
+/*
+ * With LOWDOWN_SRCPOS, maps a buffer (or part of one) being parsed back
+ * to what it was built from, so node positions can be taken in the
+ * input document.
+ * See srcpos_resolve().
+ */
+struct	srcmap {
+	const char	*base; /* start of buffer */
+	size_t		 size; /* size of buffer */
+	struct srcseg	*segs; /* spans by increasing offset */
+	size_t		 segsz; /* number of spans */
+	size_t		 segmax; /* allocated spans */
+	struct srcmap	*prev; /* outer buffer (or NULL) */
+};
+
 struct 	lowdown_doc {
 	const struct lowdown_opts *opts;
 	struct link_refq refq; /* all internal references */
+	struct link_ref	**refbins; /* first of each name, by hash */
+	size_t		 refbinsz; /* number of bins (power of two) */
+	size_t		 refbinned; /* references in bins */
 	struct footnote_refq footnotes; /* all footnotes */
 	size_t		 footnotesz; /* # of used footnotes */
 	int		 active_char[256]; /* jump table */
@@ -100,6 +185,22 @@ struct 	lowdown_doc {
 	struct hbufq	 metaq; /* raw metadata key/values */
 	size_t		 depth; /* current parse tree depth */
 	size_t		 maxdepth; /* max parse tree depth */
+	size_t		 blockgen; /* current parse_block() */
+	size_t		 blockgens; /* number of parse_block() */
+	struct htmlblock_noend noend[BLOCKTAG_MAX]; /* by tag */
+	struct span_memo memo; /* see find_chr() */
+	int		 render; /* see doc_render() */
+	unsigned int	 passes; /* see doc_pass() */
+	int		 parsed; /* lowdown_doc_parse() done */
+	const struct lowdown_events *events; /* lowdown_doc_events() */
+	const char	*src; /* input (LOWDOWN_SRCPOS) */
+	size_t		 srcsz; /* size of input */
+	size_t		*lines; /* offsets of input lines */
+	size_t		 linesz; /* number of input lines */
+	size_t		 linelast; /* last srcpos_line() (less one) */
+	struct srcmap	*maps; /* innermost buffer's map */
+	struct hstrtab	*strs; /* interned strings (LOWDOWN_INTERN) */
+	struct lowdown_node *root; /* root being parsed */
 };
 
 /*
@@ -124,6 +225,9 @@ static size_t char_image(struct lowdown_doc *, char *, size_t, size_t);
 static size_t char_superscript(struct lowdown_doc *, char *, size_t, size_t);
 static size_t char_math(struct lowdown_doc *, char *, size_t, size_t);
 
+static int doc_pass_run(struct lowdown_doc *, struct lowdown_node *);
+static void events_flush(struct lowdown_doc *, struct lowdown_node *, size_t);
+
 enum markdown_char_t {
 	MD_CHAR_NONE = 0,
 	MD_CHAR_EMPHASIS,
@@ -163,6 +267,12 @@ static char_trigger markdown_char_ptrs[] = {
 /* Some forward declarations. */
 
 static void parse_block(struct lowdown_doc *, char *, size_t);
+static void srcpos_children(struct lowdown_doc *,
+	const struct lowdown_node *);
+static struct lowdown_pos *srcpos_get(struct lowdown_doc *,
+	const struct lowdown_node *);
+static void srcpos_set(struct lowdown_doc *, struct lowdown_node *,
+	const char *, const char *);
 static size_t parse_listitem(struct lowdown_buf *, 
 	struct lowdown_doc *, char *, size_t, enum hlist_fl *, size_t);
 
@@ -182,6 +292,33 @@ pushnode(struct lowdown_doc *doc, enum lowdown_rndrt t)
 	if (n->parent != NULL)
 		TAILQ_INSERT_TAIL(&n->parent->children, n, entries);
 	doc->current = n;
+	LOWDOWN_PROBE2(node__push, t, n->id);
+
+	/*
+	 * The root spans the whole input, which is known before any of
+	 * it is parsed, so it has its position for lowdown_doc_events().
+	 */
+
+	if (t == LOWDOWN_ROOT) {
+		doc->root = n;
+		if (doc->ext_flags & LOWDOWN_SRCPOS)
+			srcpos_set(doc, n,
+				doc->src, doc->src + doc->srcsz);
+	}
+
+	/*
+	 * With lowdown_doc_events(), emit and free top-level blocks as
+	 * soon as they can no longer be modified: definition lists
+	 * modify the two blocks preceding this one.
+	 */
+
+	if (doc->events != NULL) {
+		if (t == LOWDOWN_ROOT && doc->events->enter != NULL)
+			doc->events->enter(doc->events->arg, n);
+		else if (n->parent != NULL &&
+		    n->parent->type == LOWDOWN_ROOT)
+			events_flush(doc, n->parent, 3);
+	}
 	return n;
 }
 
@@ -199,14 +336,353 @@ pushbuffer(struct lowdown_buf *buf, const char *data, size_t datasz)
 	memcpy(buf->data, data, datasz);
 }
 
+/*
+ * Like pushbuffer(), but for an inline span parsed after the input is
+ * gone (compact table rows and LOWDOWN_LAZY).
+ * The inline parser may look a few bytes past the end of a span, which
+ * in place is still in the input, so pad the copy with NUL bytes.
+ */
+static void
+pushspan(struct lowdown_buf *buf, const char *data, size_t datasz)
+{
+
+	memset(buf, 0, sizeof(struct lowdown_buf));
+	buf->data = xcalloc(1, datasz + SPAN_SLACK);
+	buf->size = datasz;
+	buf->asize = datasz + SPAN_SLACK;
+	memcpy(buf->data, data, datasz);
+}
+
+/*
+ * Like pushbuffer(), but for strings often repeated in a document (link
+ * targets and titles, code languages), which share storage with
+ * LOWDOWN_INTERN.
+ */
+static void
+pushstring(struct lowdown_doc *doc, struct lowdown_buf *buf,
+	const char *data, size_t datasz)
+{
+
+	if (doc->strs != NULL)
+		hbuf_intern(doc->strs, buf, data, datasz);
+	else
+		pushbuffer(buf, data, datasz);
+}
+
 static void
 popnode(struct lowdown_doc *doc, const struct lowdown_node *n)
 {
 
+	struct lowdown_node	*cur = doc->current;
+
 	assert(doc->depth > 0);
 	doc->depth--;
-	assert(doc->current == n);
-	doc->current = doc->current->parent;
+	assert(cur == n);
+	doc->current = cur->parent;
+	if ((doc->ext_flags & LOWDOWN_SRCPOS) &&
+	    srcpos_get(doc, cur)->line == 0)
+		srcpos_children(doc, cur);
+	if (doc->passes && doc->parsed)
+		doc_pass_run(doc, cur);
+	LOWDOWN_PROBE2(node__pop, n->type, n->id);
+}
+
+/*
+ * Record in "m" that the buffer being built has, from "off", bytes from
+ * "src" or, if "srcsz" is zero, bytes expanded from the byte at "src".
+ * Spans continuing the last one are merged into it.
+ */
+static void
+srcmap_add(struct srcmap *m, size_t off, const char *src, size_t srcsz)
+{
+	struct srcseg	*seg;
+
+	if (m->segsz > 0) {
+		seg = &m->segs[m->segsz - 1];
+		if (srcsz > 0 && seg->srcsz > 0 &&
+		    seg->off + seg->srcsz == off &&
+		    seg->src + seg->srcsz == src) {
+			seg->srcsz += srcsz;
+			return;
+		}
+	}
+	if (m->segsz == m->segmax) {
+		m->segmax = m->segmax == 0 ? 16 : m->segmax * 2;
+		m->segs = xreallocarray(m->segs,
+			m->segmax, sizeof(struct srcseg));
+	}
+	seg = &m->segs[m->segsz++];
+	seg->off = off;
+	seg->src = src;
+	seg->srcsz = srcsz;
+}
+
+/*
+ * Like hbuf_put(), but with LOWDOWN_SRCPOS, also records the source of
+ * the bytes in "m".
+ */
+static void
+srcmap_put(const struct lowdown_doc *doc, struct srcmap *m,
+	struct lowdown_buf *ob, const char *data, size_t size)
+{
+
+	if (doc->ext_flags & LOWDOWN_SRCPOS)
+		srcmap_add(m, ob->size, data, size);
+	hbuf_put(ob, data, size);
+}
+
+/*
+ * Like hbuf_putc(), but with LOWDOWN_SRCPOS, also records "src" as the
+ * source of the byte in "m".
+ */
+static void
+srcmap_putc(const struct lowdown_doc *doc, struct srcmap *m,
+	struct lowdown_buf *ob, char c, const char *src)
+{
+
+	if (doc->ext_flags & LOWDOWN_SRCPOS)
+		srcmap_add(m, ob->size, src, 1);
+	hbuf_putc(ob, c);
+}
+
+/*
+ * Make "m" the map of the buffer "base" about to be parsed.
+ * It must be removed with srcmap_pop() once parsed.
+ */
+static void
+srcmap_push(struct lowdown_doc *doc, struct srcmap *m,
+	const char *base, size_t size)
+{
+
+	m->base = base;
+	m->size = size;
+	m->prev = doc->maps;
+	doc->maps = m;
+}
+
+static void
+srcmap_pop(struct lowdown_doc *doc, struct srcmap *m)
+{
+
+	assert(doc->maps == m);
+	doc->maps = m->prev;
+}
+
+/*
+ * Offset in the input document of "p", which is in a buffer being
+ * parsed, or (size_t)-1 if it doesn't come from the input.
+ * Buffers built from other buffers are mapped back one at a time,
+ * innermost first.
+ */
+static size_t
+srcpos_resolve(const struct lowdown_doc *doc, const char *p)
+{
+	const struct srcmap	*m;
+	const struct srcseg	*seg;
+	size_t			 lo, hi, mid, d;
+
+	for (m = doc->maps; m != NULL; m = m->prev) {
+		if (m->segsz == 0 ||
+		    p < m->base || p >= m->base + m->size)
+			continue;
+		d = p - m->base;
+		lo = 0;
+		hi = m->segsz;
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+			if (m->segs[mid].off <= d)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		seg = &m->segs[lo];
+		if (seg->off > d)
+			return (size_t)-1;
+		d -= seg->off;
+		if (d >= seg->srcsz)
+			d = seg->srcsz > 0 ? seg->srcsz - 1 : 0;
+		p = seg->src + d;
+	}
+
+	if (doc->src == NULL ||
+	    p < doc->src || p >= doc->src + doc->srcsz)
+		return (size_t)-1;
+	return p - doc->src;
+}
+
+/*
+ * Index the lines of the input document "data" for srcpos_line().
+ * Lines end with a newline, a carriage return, or both.
+ */
+static void
+srcpos_lines(struct lowdown_doc *doc, const char *data, size_t size)
+{
+	size_t	 i, max = 64;
+
+	doc->src = data;
+	doc->srcsz = size;
+	doc->lines = xreallocarray(NULL, max, sizeof(size_t));
+	doc->lines[0] = 0;
+	doc->linesz = 1;
+	doc->linelast = 0;
+
+	for (i = 0; i + 1 < size; i++) {
+		if (data[i] != '\n' &&
+		    (data[i] != '\r' || data[i + 1] == '\n'))
+			continue;
+		if (doc->linesz == max) {
+			max *= 2;
+			doc->lines = xreallocarray(doc->lines,
+				max, sizeof(size_t));
+		}
+		doc->lines[doc->linesz++] = i + 1;
+	}
+}
+
+/*
+ * Line (from one) of the input document offset "off".
+ * Offsets are mostly looked up in order, so first try the line of the
+ * last lookup and the one after it.
+ */
+static size_t
+srcpos_line(struct lowdown_doc *doc, size_t off)
+{
+	size_t	 lo = doc->linelast, hi = doc->linesz, mid;
+
+	if (doc->lines[lo] <= off) {
+		if (lo + 1 == hi || off < doc->lines[lo + 1])
+			return lo + 1;
+		if (lo + 2 == hi || off < doc->lines[lo + 2])
+			return (doc->linelast = lo + 1) + 1;
+	} else
+		lo = 0;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (doc->lines[mid] <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	doc->linelast = lo - 1;
+	return lo;
+}
+
+/*
+ * Position of "n" in the root's table (see lowdown_node_pos()).
+ * The table is grown to hold every node made so far, so the pointer
+ * stays good until more nodes are made.
+ */
+static struct lowdown_pos *
+srcpos_get(struct lowdown_doc *doc, const struct lowdown_node *n)
+{
+	struct rndr_root	*r = &doc->root->rndr_root;
+	size_t			 made = doc->nodes - doc->root->id, max;
+
+	assert(n->id - doc->root->id < made);
+	if (made > r->posz) {
+		max = r->posz == 0 ? 64 : r->posz * 2;
+		if (max < made)
+			max = made;
+		r->pos = xreallocarray(r->pos,
+			max, sizeof(struct lowdown_pos));
+		memset(r->pos + r->posz, 0,
+			(max - r->posz) * sizeof(struct lowdown_pos));
+		r->posz = max;
+	}
+	return &r->pos[n->id - doc->root->id];
+}
+
+/*
+ * Set the position of "n" to the span [beg, end) of the buffer being
+ * parsed.
+ * It's left unset if the span isn't from the input or is past what the
+ * position can hold.
+ */
+static void
+srcpos_set(struct lowdown_doc *doc, struct lowdown_node *n,
+	const char *beg, const char *end)
+{
+	struct lowdown_pos	*pos;
+	size_t			 b, e;
+
+	if (end <= beg ||
+	    (b = srcpos_resolve(doc, beg)) == (size_t)-1 ||
+	    (e = srcpos_resolve(doc, end - 1)) == (size_t)-1 ||
+	    e < b || e >= UINT_MAX)
+		return;
+
+	pos = srcpos_get(doc, n);
+	pos->off = b;
+	pos->len = e + 1 - b;
+	pos->line = srcpos_line(doc, b);
+	pos->lines = srcpos_line(doc, e) - pos->line;
+}
+
+/*
+ * If parsing the span [beg, end) of the buffer being parsed added only
+ * one node to the current node, after "last" (or first if NULL), set
+ * the node's position to the span.
+ */
+static void
+srcpos_span(struct lowdown_doc *doc,
+	const struct lowdown_node *last, const char *beg, const char *end)
+{
+	struct lowdown_node	*n;
+
+	if (end == beg || doc->current == NULL)
+		return;
+	n = TAILQ_LAST(&doc->current->children, lowdown_nodeq);
+	if (n != NULL && n != last &&
+	    TAILQ_PREV(n, lowdown_nodeq, entries) == last)
+		srcpos_set(doc, n, beg, end);
+}
+
+/*
+ * Like srcpos_span(), but for blocks, which don't include the trailing
+ * white-space and blank lines they consume.
+ */
+static void
+srcpos_block(struct lowdown_doc *doc,
+	const struct lowdown_node *last, const char *beg, const char *end)
+{
+
+	while (end > beg && (end[-1] == '\n' || end[-1] == ' '))
+		end--;
+	srcpos_span(doc, last, beg, end);
+}
+
+/*
+ * Set the position of "n" to span those of its children with positions.
+ * This is used for nodes whose position isn't otherwise known.
+ */
+static void
+srcpos_children(struct lowdown_doc *doc, const struct lowdown_node *n)
+{
+	const struct lowdown_node	*c;
+	struct lowdown_pos		*pos;
+	const struct lowdown_pos	*cpos;
+	unsigned int			 end = 0, endline = 0;
+
+	pos = srcpos_get(doc, n);
+	TAILQ_FOREACH(c, &n->children, entries) {
+		cpos = srcpos_get(doc, c);
+		if (cpos->line == 0)
+			continue;
+		if (pos->line == 0 || cpos->off < pos->off) {
+			pos->off = cpos->off;
+			pos->line = cpos->line;
+		}
+		if (cpos->off + cpos->len > end) {
+			end = cpos->off + cpos->len;
+			endline = cpos->line + cpos->lines;
+		}
+	}
+
+	if (pos->line != 0) {
+		pos->len = end - pos->off;
+		pos->lines = endline - pos->line;
+	}
 }
 
 static void
@@ -230,33 +706,87 @@ unscape_text(struct lowdown_buf *ob, struct lowdown_buf *src)
 	}
 }
 
+/*
+ * Look up the reference "name" by its hash, or NULL if not found.
+ * Only the first definition of a name is binned, so it wins.
+ */
 static struct link_ref *
-find_link_ref(struct link_refq *q, char *name, size_t length)
+find_link_ref(const struct lowdown_doc *doc, const char *name,
+	size_t length)
 {
-	struct link_ref *ref;
-
-	TAILQ_FOREACH(ref, q, entries) 
-		if ((NULL == ref->name && 0 == length) ||
-		    (NULL != ref->name &&
-		     ref->name->size == length &&
-		     0 == memcmp(ref->name->data, name, length)))
+	struct link_ref	*ref;
+	uint32_t	 hash;
+
+	if (doc->refbins == NULL)
+		return NULL;
+
+	hash = hbuf_hash(name, length);
+	for (ref = doc->refbins[hash & (doc->refbinsz - 1)];
+	     ref != NULL; ref = ref->next)
+		if (ref->hash == hash &&
+		    ((NULL == ref->name && 0 == length) ||
+		     (NULL != ref->name &&
+		      ref->name->size == length &&
+		      0 == memcmp(ref->name->data, name, length))))
 			return(ref);
 
 	return NULL;
 }
 
+/*
+ * Add "ref", whose name has been filled in, to the hash bins unless
+ * its name was already defined.
+ * The bins are doubled to keep chains short.
+ */
 static void
-free_link_refs(struct link_refq *q)
+bin_link_ref(struct lowdown_doc *doc, struct link_ref *ref)
+{
+	struct link_ref	**bins, *r, *next;
+	size_t		  i, binsz, namesz = 0;
+	const char	 *name = NULL;
+
+	if (ref->name != NULL) {
+		name = ref->name->data;
+		namesz = ref->name->size;
+	}
+	if (find_link_ref(doc, name, namesz) != NULL)
+		return;
+	ref->hash = hbuf_hash(name, namesz);
+
+	if (doc->refbinned >= doc->refbinsz) {
+		binsz = doc->refbinsz == 0 ? 64 : doc->refbinsz * 2;
+		bins = xcalloc(binsz, sizeof(struct link_ref *));
+		for (i = 0; i < doc->refbinsz; i++)
+			for (r = doc->refbins[i]; r != NULL; r = next) {
+				next = r->next;
+				r->next = bins[r->hash & (binsz - 1)];
+				bins[r->hash & (binsz - 1)] = r;
+			}
+		free(doc->refbins);
+		doc->refbins = bins;
+		doc->refbinsz = binsz;
+	}
+
+	ref->next = doc->refbins[ref->hash & (doc->refbinsz - 1)];
+	doc->refbins[ref->hash & (doc->refbinsz - 1)] = ref;
+	doc->refbinned++;
+}
+
+static void
+free_link_refs(struct lowdown_doc *doc)
 {
 	struct link_ref *r;
 
-	while (NULL != (r = TAILQ_FIRST(q))) {
-		TAILQ_REMOVE(q, r, entries);
+	while (NULL != (r = TAILQ_FIRST(&doc->refq))) {
+		TAILQ_REMOVE(&doc->refq, r, entries);
 		hbuf_free(r->link);
 		hbuf_free(r->name);
 		hbuf_free(r->title);
 		free(r);
 	}
+	free(doc->refbins);
+	doc->refbins = NULL;
+	doc->refbinsz = doc->refbinned = 0;
 }
 
 static struct footnote_ref *
@@ -283,6 +813,9 @@ free_footnote_refs(struct footnote_refq *q)
 		TAILQ_REMOVE(q, ref, entries);
 		hbuf_free(ref->contents);
 		hbuf_free(ref->name);
+		if (ref->map != NULL)
+			free(ref->map->segs);
+		free(ref->map);
 		free(ref);
 	}
 }
@@ -445,11 +978,35 @@ parse_image_attrs(struct rndr_image *img, const char *data, size_t size)
 	return end + 1;
 }
 
+/*
+ * Returns the offset of the next "c" in "data", or "size" if none.
+ * The answer is remembered in "m" for later starts in the same span, so
+ * text heavy in openers doesn't rescan to the same closer (or to the
+ * end) from each of them.
+ */
+static size_t
+find_chr(struct chr_memo *m, char c, const char *data, size_t size)
+{
+	const char	*p;
+
+	if (m->end == data + size &&
+	    data >= m->from && data <= m->next)
+		return m->next - data;
+
+	if ((p = memchr(data, c, size)) == NULL)
+		p = data + size;
+	m->from = data;
+	m->next = p;
+	m->end = data + size;
+	return p - data;
+}
+
 /*
  * Returns the length of the given tag, or 0 is it's not valid.
  */
 static size_t
-tag_length(const char *data, size_t size, enum halink_type *ltype)
+tag_length(struct lowdown_doc *doc,
+	const char *data, size_t size, enum halink_type *ltype)
 {
 	size_t i, j;
 
@@ -494,13 +1051,13 @@ tag_length(const char *data, size_t size, enum halink_type *ltype)
 	       data[i] == '.' || data[i] == '+' || data[i] == '-'))
 		i++;
 
-	if (i > 1 && data[i] == '@')
+	if (i > 1 && i < size && data[i] == '@')
 		if ((j = is_mail_autolink(data + i, size - i)) != 0) {
 			*ltype = HALINK_EMAIL;
 			return i + j;
 		}
 
-	if (i > 2 && data[i] == ':') {
+	if (i > 2 && i < size && data[i] == ':') {
 		*ltype = HALINK_NORMAL;
 		i++;
 	}
@@ -534,13 +1091,38 @@ tag_length(const char *data, size_t size, enum halink_type *ltype)
 
 	/* Looking for something looking like a tag end. */
 
-	while (i < size && data[i] != '>')
-		i++;
+	if (i < size)
+		i += find_chr(&doc->memo.gt, '>', data + i, size - i);
 	if (i >= size)
 		return 0;
 	return i + 1;
 }
 
+/*
+ * Allocation-free check of whether an autolink trigger at "data" might
+ * be the start of (or, for e-mail, within) a link.
+ * This never rejects what the halink functions would accept.
+ * Returns zero if there can be no link, non-zero otherwise (also for
+ * any other kind of trigger).
+ */
+static int
+char_autolink_prefix(int c, const char *data, size_t offset, size_t size)
+{
+
+	switch (c) {
+	case MD_CHAR_AUTOLINK_URL:
+		return size >= 4 && data[1] == '/' && data[2] == '/';
+	case MD_CHAR_AUTOLINK_WWW:
+		return size >= 4 && memcmp(data, "www.", 4) == 0;
+	case MD_CHAR_AUTOLINK_EMAIL:
+		return offset > 0 && (isalnum((unsigned char)data[-1]) ||
+			strchr(".+-_", data[-1]) != NULL);
+	default:
+		break;
+	}
+	return 1;
+}
+
 /*
  * Parses inline markdown elements.
  * This function is important because it handles raw input that we pass
@@ -552,15 +1134,30 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 	size_t	 	 	 i = 0, end = 0, consumed = 0;
 	struct lowdown_buf	 work;
 	const int		*active_char = doc->active_char;
-	struct lowdown_node 	*n;
+	struct lowdown_node 	*n, *last = NULL;
+	struct span_memo	 memo = doc->memo;
 
 	memset(&work, 0, sizeof(struct lowdown_buf));
+
+	/* 
+	 * Start afresh with find_chr(), as nested spans may be parsed
+	 * from other buffers.
+	 */
+
+	memset(&doc->memo, 0, sizeof(struct span_memo));
 	
 	while (i < size) {
-		/* Copying non-macro chars into the output. */
+		/* 
+		 * Copying non-macro chars into the output.
+		 * Skip over autolink triggers that can't match, else
+		 * prose would be split into a text node per 'w'.
+		 */
 
 		while (end < size && 
-		       active_char[(unsigned char)data[end]] == 0)
+		       (active_char[(unsigned char)data[end]] == 0 ||
+			!char_autolink_prefix
+			 (active_char[(unsigned char)data[end]],
+			  data + end, end - consumed, size - end)))
 			end++;
 
 		/* Only allocate if non-empty... */
@@ -570,6 +1167,8 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 			pushbuffer(&n->rndr_normal_text.text, 
 				data + i, end - i);
 			popnode(doc, n);
+			if (doc->ext_flags & LOWDOWN_SRCPOS)
+				srcpos_set(doc, n, data + i, data + end);
 		}
 
 		/* End of file? */
@@ -577,6 +1176,10 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 		if (end >= size)
 			break;
 
+		if (doc->ext_flags & LOWDOWN_SRCPOS)
+			last = TAILQ_LAST
+				(&doc->current->children, lowdown_nodeq);
+
 		i = end;
 		end = markdown_char_ptrs[
 			active_char[(unsigned char)data[end]]]
@@ -589,6 +1192,9 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 			continue;
 		}
 
+		if (doc->ext_flags & LOWDOWN_SRCPOS)
+			srcpos_span(doc, last, data + i, data + i + end);
+
 		i += end;
 		end = consumed = i;
 
@@ -614,6 +1220,82 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 			end = consumed = i;
 		}
 	}
+
+	doc->memo = memo;
+}
+
+/*
+ * Where "n" keeps its unparsed children with LOWDOWN_LAZY, or NULL if
+ * its type can't have any.
+ */
+static struct lowdown_lazy **
+node_lazy(const struct lowdown_node *n)
+{
+	struct lowdown_node	*nn = (struct lowdown_node *)n;
+
+	switch (n->type) {
+	case LOWDOWN_HEADER:
+		return &nn->rndr_header.lazy;
+	case LOWDOWN_DEFINITION_TITLE:
+		/* A paragraph until parse_definition(). */
+	case LOWDOWN_PARAGRAPH:
+		return &nn->rndr_paragraph.lazy;
+	case LOWDOWN_TABLE_CELL:
+		return &nn->rndr_table_cell.lazy;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Whether the children of "n" were left unparsed with LOWDOWN_LAZY.
+ */
+int
+lazy_unparsed(const struct lowdown_node *n)
+{
+	struct lowdown_lazy	**lazy = node_lazy(n);
+
+	return lazy != NULL && *lazy != NULL;
+}
+
+/*
+ * Like parse_inline(), but with LOWDOWN_LAZY, only record the span in
+ * the current node for lowdown_node_children().
+ * Spans possibly with links, images, footnotes, or metadata references
+ * are parsed now: they depend upon the reference, footnote, and
+ * metadata state of the parse.
+ */
+static void
+parse_inline_lazy(struct lowdown_doc *doc, char *data, size_t size)
+{
+	struct lowdown_lazy	**lazy;
+
+	if (!(doc->ext_flags & LOWDOWN_LAZY) || size == 0 ||
+	    memchr(data, '[', size) != NULL) {
+		parse_inline(doc, data, size);
+		return;
+	}
+
+	assert(doc->current != NULL);
+	lazy = node_lazy(doc->current);
+	assert(lazy != NULL && *lazy == NULL);
+	*lazy = xmalloc(sizeof(struct lowdown_lazy));
+	(*lazy)->doc = doc;
+	pushspan(&(*lazy)->text, data, size);
+}
+
+/*
+ * The parse depth of the children of "n", that is, the number of nodes
+ * from "n" to the root.
+ */
+static size_t
+node_depth(const struct lowdown_node *n)
+{
+	size_t	 depth = 0;
+
+	for ( ; n != NULL; n = n->parent)
+		depth++;
+	return depth;
 }
 
 /*
@@ -1155,7 +1837,7 @@ char_langle_tag(struct lowdown_doc *doc,
 	struct lowdown_buf 	 work;
 	struct lowdown_buf	*u_link;
 	enum halink_type 	 altype = HALINK_NONE;
-	size_t 	 	 	 end = tag_length(data, size, &altype);
+	size_t 	 	 	 end = tag_length(doc, data, size, &altype);
 	int 		 	 ret = 0;
 	struct lowdown_node 	*n;
 	
@@ -1173,7 +1855,7 @@ char_langle_tag(struct lowdown_doc *doc,
 
 			n = pushnode(doc, LOWDOWN_LINK_AUTO);
 			n->rndr_autolink.type = altype;
-			pushbuffer(&n->rndr_autolink.link, 
+			pushstring(doc, &n->rndr_autolink.link, 
 				u_link->data, u_link->size);
 			pushbuffer(&n->rndr_autolink.text, 
 				u_link->data, u_link->size);
@@ -1193,48 +1875,52 @@ char_langle_tag(struct lowdown_doc *doc,
 		return end;
 }
 
+/*
+ * An autolink may begin "rewind" bytes before the trigger character,
+ * which have already been emitted as normal text: take them back.
+ */
+static void
+autolink_rewind(struct lowdown_doc *doc, size_t rewind)
+{
+	struct lowdown_node	*n;
+
+	if (doc->current &&
+	    NULL != (n = TAILQ_LAST
+		    (&doc->current->children, 
+		     lowdown_nodeq)) &&
+	    LOWDOWN_NORMAL_TEXT == n->type) {
+		if (n->rndr_normal_text.text.size > rewind)
+			n->rndr_normal_text.text.size -= rewind;
+		else
+			n->rndr_normal_text.text.size = 0;
+	}
+}
+
 static size_t
 char_autolink_www(struct lowdown_doc *doc,
 	char *data, size_t offset, size_t size)
 {
-	struct lowdown_buf	*link, *link_url;
 	size_t	 		 link_len, rewind;
 	struct lowdown_node 	*n, *nn;
+	struct lowdown_buf	*url;
 
 	if (doc->in_link_body)
 		return 0;
+	if ((link_len = halink_www(&rewind, data, offset, size)) == 0)
+		return 0;
 
-	link = hbuf_new(64);
-	link_len = halink_www(&rewind, link, data, offset, size);
-
-	if (link_len > 0) {
-		link_url = hbuf_new(64);
-		HBUF_PUTSL(link_url, "http://");
-		hbuf_put(link_url, link->data, link->size);
-
-		if (doc->current &&
-		    NULL != (n = TAILQ_LAST
-			    (&doc->current->children, 
-			     lowdown_nodeq)) &&
-		    LOWDOWN_NORMAL_TEXT == n->type) {
-			if (n->rndr_normal_text.text.size > rewind)
-				n->rndr_normal_text.text.size -= rewind;
-			else
-				n->rndr_normal_text.text.size = 0;
-		}
-
-		n = pushnode(doc, LOWDOWN_LINK);
-		pushbuffer(&n->rndr_link.link, 
-			link_url->data, link_url->size);
-		nn = pushnode(doc, LOWDOWN_NORMAL_TEXT);
-		pushbuffer(&n->rndr_normal_text.text, 
-			link->data, link->size);
-		popnode(doc, nn);
-		popnode(doc, n);
-		hbuf_free(link_url);
-	}
-
-	hbuf_free(link);
+	autolink_rewind(doc, rewind);
+
+	n = pushnode(doc, LOWDOWN_LINK);
+	url = &n->rndr_link.link;
+	url->size = url->asize = strlen("http://") + link_len;
+	url->data = xmalloc(url->size);
+	memcpy(url->data, "http://", strlen("http://"));
+	memcpy(url->data + strlen("http://"), data, link_len);
+	nn = pushnode(doc, LOWDOWN_NORMAL_TEXT);
+	pushbuffer(&nn->rndr_normal_text.text, data, link_len);
+	popnode(doc, nn);
+	popnode(doc, n);
 	return link_len;
 }
 
@@ -1245,36 +1931,21 @@ static size_t
 char_autolink_email(struct lowdown_doc *doc,
 	char *data, size_t offset, size_t size)
 {
-	struct lowdown_buf	*link;
 	size_t	 		 link_len, rewind;
 	struct lowdown_node 	*n;
 
 	if (doc->in_link_body)
 		return 0;
+	if ((link_len = halink_email(&rewind, data, offset, size)) == 0)
+		return 0;
 
-	link = hbuf_new(64);
-	link_len = halink_email(&rewind, link, data, offset, size);
-
-	if (link_len > 0) {
-		if (doc->current &&
-		    NULL != (n = TAILQ_LAST
-			    (&doc->current->children, 
-			     lowdown_nodeq)) &&
-		    LOWDOWN_NORMAL_TEXT == n->type) {
-			if (n->rndr_normal_text.text.size > rewind)
-				n->rndr_normal_text.text.size -= rewind;
-			else
-				n->rndr_normal_text.text.size = 0;
-		}
-
-		n = pushnode(doc, LOWDOWN_LINK_AUTO);
-		n->rndr_autolink.type = HALINK_EMAIL;
-		pushbuffer(&n->rndr_autolink.link, 
-			link->data, link->size);
-		popnode(doc, n);
-	}
+	autolink_rewind(doc, rewind);
 
-	hbuf_free(link);
+	n = pushnode(doc, LOWDOWN_LINK_AUTO);
+	n->rndr_autolink.type = HALINK_EMAIL;
+	pushstring(doc, &n->rndr_autolink.link, 
+		data - rewind, link_len + rewind);
+	popnode(doc, n);
 	return link_len;
 }
 
@@ -1282,36 +1953,21 @@ static size_t
 char_autolink_url(struct lowdown_doc *doc,
 	char *data, size_t offset, size_t size)
 {
-	struct lowdown_buf	*link;
 	size_t			 link_len, rewind;
 	struct lowdown_node 	*n;
 
 	if (doc->in_link_body)
 		return 0;
+	if ((link_len = halink_url(&rewind, data, offset, size)) == 0)
+		return 0;
 
-	link = hbuf_new(64);
-	link_len = halink_url(&rewind, link, data, offset, size);
-
-	if (link_len > 0) {
-		if (doc->current &&
-		    NULL != (n = TAILQ_LAST
-			    (&doc->current->children, 
-			     lowdown_nodeq)) &&
-		    LOWDOWN_NORMAL_TEXT == n->type) {
-			if (n->rndr_normal_text.text.size > rewind)
-				n->rndr_normal_text.text.size -= rewind;
-			else
-				n->rndr_normal_text.text.size = 0;
-		}
+	autolink_rewind(doc, rewind);
 
-		n = pushnode(doc, LOWDOWN_LINK_AUTO);
-		n->rndr_autolink.type = HALINK_NORMAL;
-		pushbuffer(&n->rndr_autolink.link, 
-			link->data, link->size);
-		popnode(doc, n);
-	}
-
-	hbuf_free(link);
+	n = pushnode(doc, LOWDOWN_LINK_AUTO);
+	n->rndr_autolink.type = HALINK_NORMAL;
+	pushstring(doc, &n->rndr_autolink.link, 
+		data - rewind, link_len + rewind);
+	popnode(doc, n);
 	return link_len;
 }
 
@@ -1361,8 +2017,13 @@ char_link(struct lowdown_doc *doc,
 	is_metadata = (doc->ext_flags & LOWDOWN_METADATA && 
 			data[1] == '%');
 
-	/* Looking for the matching closing bracket. */
+	/*
+	 * Looking for the matching closing bracket.
+	 * Don't bother if there's no ']' at all.
+	 */
 
+	if (find_chr(&doc->memo.rbrack, ']', data + i, size - i) == size - i)
+		goto cleanup;
 	i += find_emph_char(data + i, size - i, ']');
 	txt_e = i;
 
@@ -1467,6 +2128,11 @@ char_link(struct lowdown_doc *doc,
 
 		link_b = i;
 
+		/* Every way out of here needs a ')'. */
+
+		if (find_chr(&doc->memo.rparen, ')', data + i, size - i) == size - i)
+			goto cleanup;
+
 		/* 
 		 * Looking for link end: ' " ) 
 		 * Count the number of open parenthesis.
@@ -1640,7 +2306,7 @@ again:
 		else
 			hbuf_put(idp, data + link_b, link_e - link_b);
 
-		lr = find_link_ref(&doc->refq, idp->data, idp->size);
+		lr = find_link_ref(doc, idp->data, idp->size);
 		if ( ! lr)
 			goto cleanup;
 
@@ -1661,7 +2327,7 @@ again:
 
 		/* Finding the link_ref. */
 
-		lr = find_link_ref(&doc->refq, idp->data, idp->size);
+		lr = find_link_ref(doc, idp->data, idp->size);
 		if ( ! lr)
 			goto cleanup;
 
@@ -1706,10 +2372,10 @@ again:
 
 	if (is_img) {
 		if (NULL != u_link)
-			pushbuffer(&n->rndr_image.link,
+			pushstring(doc, &n->rndr_image.link,
 				u_link->data, u_link->size);
 		if (NULL != title)
-			pushbuffer(&n->rndr_image.title,
+			pushstring(doc, &n->rndr_image.title,
 				title->data, title->size);
 		if (NULL != dims)
 			pushbuffer(&n->rndr_image.dims,
@@ -1720,10 +2386,10 @@ again:
 		ret = 1;
 	} else {
 		if (NULL != u_link)
-			pushbuffer(&n->rndr_link.link,
+			pushstring(doc, &n->rndr_link.link,
 				u_link->data, u_link->size);
 		if (NULL != title)
-			pushbuffer(&n->rndr_link.title,
+			pushstring(doc, &n->rndr_link.title,
 				title->data, title->size);
 		ret = 1;
 	}
@@ -2107,6 +2773,9 @@ parse_blockquote(struct lowdown_doc *doc, char *data, size_t size)
 	size_t			 beg = 0, end = 0, pre, work_size = 0;
 	char			*work_data = NULL;
 	struct lowdown_node	*n;
+	struct srcmap		 map;
+
+	memset(&map, 0, sizeof(struct srcmap));
 
 	while (beg < size) {
 		for (end = beg + 1; 
@@ -2127,6 +2796,9 @@ parse_blockquote(struct lowdown_doc *doc, char *data, size_t size)
 			break;
 
 		if (beg < end) {
+			if (doc->ext_flags & LOWDOWN_SRCPOS)
+				srcmap_add(&map, work_size,
+					data + beg, end - beg);
 			if (!work_data)
 				work_data = data + beg;
 			else if (data + beg != work_data + work_size)
@@ -2138,8 +2810,11 @@ parse_blockquote(struct lowdown_doc *doc, char *data, size_t size)
 	}
 
 	n = pushnode(doc, LOWDOWN_BLOCKQUOTE);
+	srcmap_push(doc, &map, work_data, work_size);
 	parse_block(doc, work_data, work_size);
+	srcmap_pop(doc, &map);
 	popnode(doc, n);
+	free(map.segs);
 	return end;
 }
 
@@ -2211,7 +2886,7 @@ parse_paragraph(struct lowdown_doc *doc, char *data, size_t size)
 		n = pushnode(doc, LOWDOWN_PARAGRAPH);
 		n->rndr_paragraph.lines = lines;
 		n->rndr_paragraph.beoln = beoln;
-		parse_inline(doc, work.data, work.size);
+		parse_inline_lazy(doc, work.data, work.size);
 		popnode(doc, n);
 		doc->cur_par++;
 		return end;
@@ -2232,7 +2907,7 @@ parse_paragraph(struct lowdown_doc *doc, char *data, size_t size)
 			n = pushnode(doc, LOWDOWN_PARAGRAPH);
 			n->rndr_paragraph.lines = lines - 1;
 			n->rndr_paragraph.beoln = beoln;
-			parse_inline(doc, work.data, work.size);
+			parse_inline_lazy(doc, work.data, work.size);
 			popnode(doc, n);
 			doc->cur_par++;
 			work.data += beg;
@@ -2246,7 +2921,7 @@ parse_paragraph(struct lowdown_doc *doc, char *data, size_t size)
 	n = pushnode(doc, LOWDOWN_HEADER);
 	assert(level > 0);
 	n->rndr_header.level = level - 1;
-	parse_inline(doc, work.data, work.size);
+	parse_inline_lazy(doc, work.data, work.size);
 	popnode(doc, n);
 	return end;
 }
@@ -2257,49 +2932,69 @@ parse_paragraph(struct lowdown_doc *doc, char *data, size_t size)
 static size_t
 parse_fencedcode(struct lowdown_doc *doc, char *data, size_t size)
 {
-	struct lowdown_buf	 text, lang;
-	size_t	 		 i = 0, text_start, line_start,
+	struct lowdown_buf	 lang;
+	size_t	 		 i, text_start, line_start, fence,
 				 w, w2, width, width2;
 	char	 		 chr, chr2;
+	const char		*cp;
 	struct lowdown_node 	*n;
 
-	memset(&text, 0, sizeof(struct lowdown_buf));
 	memset(&lang, 0, sizeof(struct lowdown_buf));
 
 	/* Parse codefence line. */
 
-	while (i < size && data[i] != '\n')
-		i++;
+	cp = memchr(data, '\n', size);
+	i = cp == NULL ? size : (size_t)(cp - data);
 
 	w = parse_codefence(data, i, &lang, &width, &chr);
 	if (!w)
 		return 0;
 
-	/* Search for end. */
+	/* 
+	 * Search for end.
+	 * Only a line starting (after at most three spaces) with the
+	 * fence character can close the block, so jump between those
+	 * characters with memchr(3) instead of walking every line.
+	 * Unterminated blocks run to the end.
+	 */
 
-	i++;
-	text_start = i;
-	while ((line_start = i) < size) {
-		while (i < size && data[i] != '\n')
-			i++;
+	text_start = i = i < size ? i + 1 : size;
+	line_start = size;
+	while (i < size &&
+	       (cp = memchr(data + i, chr, size - i)) != NULL) {
+		fence = cp - data;
+		cp = memchr(cp, '\n', size - fence);
+		i = cp == NULL ? size : (size_t)(cp - data);
 
-		w2 = is_codefence(data + line_start, 
-			i - line_start, &width2, &chr2);
+		/* Back up over indentation to the line start. */
 
-		if (w == w2 && width == width2 && chr == chr2 &&
-		    is_empty(data + (line_start+w), i - (line_start+w)))
-			break;
+		for (line_start = fence; 
+		     line_start > text_start && fence - line_start < 3 &&
+		     data[line_start - 1] == ' '; line_start--)
+			continue;
 
-		i++;
+		if (line_start == text_start ||
+		    data[line_start - 1] == '\n') {
+			w2 = is_codefence(data + line_start, 
+				i - line_start, &width2, &chr2);
+			if (w == w2 && width == width2 && chr == chr2 &&
+			    is_empty(data + (line_start + w), 
+			     i - (line_start + w)))
+				break;
+		}
+
+		line_start = size;
+		if (i < size)
+			i++;
 	}
 
-	text.data = data + text_start;
-	text.size = line_start - text_start;
+	if (line_start == size)
+		i = size;
 
 	n = pushnode(doc, LOWDOWN_BLOCKCODE);
 	pushbuffer(&n->rndr_blockcode.text, 
 		data + text_start, line_start - text_start);
-	pushbuffer(&n->rndr_blockcode.lang, 
+	pushstring(doc, &n->rndr_blockcode.lang, 
 		lang.data, lang.size);
 	popnode(doc, n);
 	return i;
@@ -2308,54 +3003,67 @@ parse_fencedcode(struct lowdown_doc *doc, char *data, size_t size)
 static size_t
 parse_blockcode(struct lowdown_doc *doc, char *data, size_t size)
 {
-	size_t	 		 beg = 0, end, pre;
-	struct lowdown_buf	*work = NULL;
+	size_t	 		 beg, end, pre, sz = 0;
+	const char		*cp;
+	struct lowdown_buf	*text;
 	struct lowdown_node 	*n;
 
-	work = hbuf_new(256);
-
-	while (beg < size) {
-		for (end = beg + 1; 
-		     end < size && data[end - 1] != '\n'; 
-		     end++) 
-			continue;
+	/*
+	 * This is done in two passes over the lines: the first finds
+	 * the size of the block's text, the second copies the text into
+	 * an allocation of exactly that size.
+	 */
 
-		pre = prefix_code(data + beg, end - beg);
+	for (beg = 0; beg < size; beg = end) {
+		cp = memchr(data + beg, '\n', size - beg);
+		end = cp == NULL ? size : (size_t)(cp - data) + 1;
 
 		/* 
 		 * Skip prefix or non-empty non-prefixed line breaking
 		 * the pre. 
 		 */
 
-		if (pre)
+		if ((pre = prefix_code(data + beg, end - beg)) > 0)
 			beg += pre; 
 		else if (!is_empty(data + beg, end - beg))
 			break;
 
-		if (beg < end) {
-			/* 
-			 * Verbatim copy to the working buffer, escaping
-			 * entities. 
-			 */
-			if (is_empty(data + beg, end - beg))
-				hbuf_putc(work, '\n');
-			else 
-				hbuf_put(work, data + beg, end - beg);
-		}
-		beg = end;
+		if (beg < end)
+			sz += is_empty(data + beg, end - beg) ?
+				1 : end - beg;
 	}
 
-	while (work->size && work->data[work->size - 1] == '\n')
-		work->size -= 1;
-
-	hbuf_putc(work, '\n');
+	/* The block ends at the first non-code line. */
 
+	size = beg;
 	n = pushnode(doc, LOWDOWN_BLOCKCODE);
-	pushbuffer(&n->rndr_blockcode.text, 
-		work->data, work->size);
+	text = &n->rndr_blockcode.text;
+	text->data = xmalloc(sz + 1);
+	text->asize = sz + 1;
+
+	/* Verbatim copy of each line, empty lines being only '\n'. */
+
+	for (beg = 0; beg < size; beg = end) {
+		cp = memchr(data + beg, '\n', size - beg);
+		end = cp == NULL ? size : (size_t)(cp - data) + 1;
+		beg += prefix_code(data + beg, end - beg);
+		if (beg >= end)
+			continue;
+		if (is_empty(data + beg, end - beg))
+			text->data[text->size++] = '\n';
+		else {
+			memcpy(text->data + text->size, 
+				data + beg, end - beg);
+			text->size += end - beg;
+		}
+	}
+
+	while (text->size && text->data[text->size - 1] == '\n')
+		text->size -= 1;
+
+	text->data[text->size++] = '\n';
 	popnode(doc, n);
-	hbuf_free(work);
-	return beg;
+	return size;
 }
 
 /*
@@ -2373,6 +3081,7 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 	int			 in_empty = 0, has_inside_empty = 0,
 				 in_fence = 0, ff;
 	struct lowdown_node	*n;
+	struct srcmap		 map;
 
 	/* Keeping track of the first indentation prefix. */
 
@@ -2396,10 +3105,11 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 	/* Getting working buffers. */
 
 	work = hbuf_new(64);
+	memset(&map, 0, sizeof(struct srcmap));
 
 	/* Putting the first line into the working buffer. */
 
-	hbuf_put(work, data + beg, end - beg);
+	srcmap_put(doc, &map, work, data + beg, end - beg);
 	beg = end;
 	dli_lines = 1;
 
@@ -2505,7 +3215,7 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 		}
 
 		if (in_empty) {
-			hbuf_putc(work, '\n');
+			srcmap_putc(doc, &map, work, '\n', data + beg - 1);
 			has_inside_empty = 1;
 			in_empty = 0;
 		}
@@ -2515,7 +3225,8 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 		 * buffer.
 		 */
 
-		hbuf_put(work, data + beg + i, end - beg - i);
+		srcmap_put(doc, &map, work,
+			data + beg + i, end - beg - i);
 		beg = end;
 	}
 
@@ -2527,6 +3238,7 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 	n = pushnode(doc, LOWDOWN_LISTITEM);
 	n->rndr_listitem.flags = *flags;
 	n->rndr_listitem.num = num;
+	srcmap_push(doc, &map, work->data, work->size);
 
 	if (*flags & HLIST_FL_BLOCK) {
 		/* Intermediate render of block li. */
@@ -2550,8 +3262,10 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 			parse_inline(doc, work->data, work->size);
 	}
 
+	srcmap_pop(doc, &map);
 	popnode(doc, n);
 	hbuf_free(work);
+	free(map.segs);
 	return beg;
 }
 
@@ -2602,8 +3316,12 @@ parse_definition(struct lowdown_doc *doc, char *data, size_t size)
 		nn = pushnode(doc, LOWDOWN_DEFINITION_DATA);
 		j = parse_listitem(work, doc, 
 			data + i, size - i, &flags, k++);
-		i += j;
 		popnode(doc, nn);
+		if (doc->ext_flags & LOWDOWN_SRCPOS)
+			srcpos_block(doc, TAILQ_PREV(nn,
+				lowdown_nodeq, entries),
+				data + i, data + i + j);
+		i += j;
 		if (!j || (flags & HLIST_LI_END))
 			break;
 	}
@@ -2611,6 +3329,10 @@ parse_definition(struct lowdown_doc *doc, char *data, size_t size)
 	if (flags & HLIST_FL_BLOCK)
 		n->rndr_definition.flags |= HLIST_FL_BLOCK;
 
+	/* This may have been merged with a previous list. */
+
+	if (doc->ext_flags & LOWDOWN_SRCPOS)
+		srcpos_children(doc, n);
 	popnode(doc, n);
 	hbuf_free(work);
 	return i;
@@ -2629,7 +3351,7 @@ parse_list(struct lowdown_doc *doc,
 	const char	    	*er = NULL;
 	size_t	 	     	 i = 0, j, k = 1;
 	enum hlist_fl	     	 flags;
-	struct lowdown_node 	*n;
+	struct lowdown_node 	*n, *last;
 
 	flags = oli_data != NULL ?
 		HLIST_FL_ORDERED : HLIST_FL_UNORDERED;
@@ -2647,8 +3369,11 @@ parse_list(struct lowdown_doc *doc,
 	}
 
 	while (i < size) {
+		last = TAILQ_LAST(&n->children, lowdown_nodeq);
 		j = parse_listitem(work, doc, 
 			data + i, size - i, &flags, k++);
+		if (doc->ext_flags & LOWDOWN_SRCPOS)
+			srcpos_block(doc, last, data + i, data + i + j);
 		i += j;
 		if (!j || (flags & HLIST_LI_END))
 			break;
@@ -2691,7 +3416,7 @@ parse_atxheader(struct lowdown_doc *doc, char *data, size_t size)
 		n = pushnode(doc, LOWDOWN_HEADER);
 		assert(level > 0);
 		n->rndr_header.level = level - 1;
-		parse_inline(doc, data + i, end - i);
+		parse_inline_lazy(doc, data + i, end - i);
 		popnode(doc, n);
 	}
 
@@ -2740,9 +3465,15 @@ parse_footnote_list(struct lowdown_doc *doc)
 					LOWDOWN_FOOTNOTES_BLOCK);
 				first = 0;
 			}
+			if (ref->map != NULL)
+				srcmap_push(doc, ref->map,
+					ref->contents->data,
+					ref->contents->size);
 			parse_footnote_def(doc, ref->num,
 				ref->contents->data, 
 				ref->contents->size);
+			if (ref->map != NULL)
+				srcmap_pop(doc, ref->map);
 		}
 
 	if (NULL != n)
@@ -2837,62 +3568,75 @@ htmlblock_find_end_strict(const char *tag, size_t tag_len,
 }
 
 /*
- * Canonicalise a sequence of length "len" bytes in "str".
- * This returns NULL if the sequence is not recognised, or a
- * nil-terminated string of the sequence otherwise.
+ * Block-level HTML tags, perfectly hashed by hhtml_find_block().
  */
-static const char *
+static const char *const blocktags[BLOCKTAG_MAX] = {
+	[1] = "ul",
+	[2] = "section",
+	[4] = "h4",
+	[5] = "iframe",
+	[7] = "details",
+	[8] = "main",
+	[10] = "ol",
+	[11] = "h2",
+	[12] = "dd",
+	[16] = "aside",
+	[18] = "article",
+	[20] = "nav",
+	[22] = "form",
+	[25] = "li",
+	[29] = "math",
+	[30] = "table",
+	[32] = "noscript",
+	[34] = "pre",
+	[35] = "div",
+	[36] = "p",
+	[38] = "ins",
+	[41] = "dt",
+	[43] = "h5",
+	[44] = "fieldset",
+	[46] = "header",
+	[48] = "dialog",
+	[49] = "footer",
+	[50] = "h3",
+	[52] = "figure",
+	[53] = "hgroup",
+	[54] = "address",
+	[57] = "h1",
+	[62] = "blockquote",
+	[65] = "script",
+	[67] = "figcaption",
+	[69] = "dl",
+	[70] = "del",
+	[74] = "style",
+	[82] = "h6",
+};
+
+/*
+ * Look up the block-level HTML tag of length "len" bytes in "str",
+ * case-insensitively.
+ * The hash of the first and last characters and the length has no
+ * collisions amongst the known tags, so at most one is compared.
+ * Returns the tag's index in "blocktags" or -1 if not found.
+ */
+static int
 hhtml_find_block(const char *str, size_t len)
 {
-	static const char	*tags[] = {
-		"address",
-		"article",
-		"aside",
-		"blockquote",
-		"del",
-		"details",
-		"dialog",
-		"dd",
-		"div",
-		"dl",
-		"dt",
-		"fieldset",
-		"figcaption",
-		"figure",
-		"footer",
-		"form",
-		"h1",
-		"h2",
-		"h3",
-		"h4",
-		"h5",
-		"h6",
-		"header",
-		"hgroup",
-		"iframe",
-		"ins",
-		"li",
-		"main",
-		"math",
-		"nav",
-		"noscript",
-		"ol",
-		"p",
-		"pre",
-		"section",
-		"script",
-		"style",
-		"table",
-		"ul",
-		NULL,
-	};
-	size_t			 i;
+	size_t	 h;
 
-	for (i = 0; tags[i] != NULL; i++)
-		if (strncasecmp(tags[i], str, len) == 0)
-			return tags[i];
+	if (len == 0)
+		return -1;
 
-	return NULL;
+	h = (41 * tolower((unsigned char)str[0]) +
+	     39 * tolower((unsigned char)str[len - 1]) + len) % 
+	     BLOCKTAG_MAX;
+
+	if (blocktags[h] == NULL ||
+	    strlen(blocktags[h]) != len ||
+	    strncasecmp(blocktags[h], str, len) != 0)
+		return -1;
+
+	return h;
 }
 
 /* 
@@ -2905,6 +3649,8 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 	size_t	 	 	 i, j = 0, tag_len, tag_end;
 	const char		*curtag = NULL;
 	struct lowdown_node 	*n;
+	struct htmlblock_noend	*noend = NULL;
+	int			 tag = -1;
 
 	memset(&work, 0, sizeof(struct lowdown_buf));
 
@@ -2919,8 +3665,10 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 	while (i < size && data[i] != '>' && data[i] != ' ')
 		i++;
 
-	if (i < size)
-		curtag = hhtml_find_block(data + 1, i - 1);
+	if (i < size && (tag = hhtml_find_block(data + 1, i - 1)) != -1) {
+		curtag = blocktags[tag];
+		noend = &doc->noend[tag];
+	}
 
 	/* Handling of special cases. */
 
@@ -2979,6 +3727,15 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 		return 0;
 	}
 
+	/*
+	 * If an earlier search in this block found no closing tag from
+	 * before here to the end, neither search below can match.
+	 * Without this, many unclosed tags would each scan to the end.
+	 */
+
+	if (noend->gen == doc->blockgen && data >= noend->from)
+		return 0;
+
 	/* Looking for a matching closing tag in strict mode. */
 
 	tag_len = strlen(curtag);
@@ -2989,12 +3746,19 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 	 * If not found, trying a second pass looking for indented match
 	 * but not if tag is "ins" or "del" (following original
 	 * Markdown.pl).
+	 * Any strict match is also a match here, so a miss means there
+	 * are no closing tags at all.
 	 */
 
 	if (!tag_end && strcmp(curtag, "ins") != 0 && 
-	    strcmp(curtag, "del") != 0)
+	    strcmp(curtag, "del") != 0) {
 		tag_end = htmlblock_find_end(curtag, 
 			tag_len, doc, data, size);
+		if (!tag_end) {
+			noend->gen = doc->blockgen;
+			noend->from = data;
+		}
+	}
 
 	if (!tag_end)
 		return 0;
@@ -3009,7 +3773,7 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 	return tag_end;
 }
 
-static void
+static struct lowdown_node *
 parse_table_row(struct lowdown_buf *ob, struct lowdown_doc *doc,
 	char *data, size_t size, size_t columns, 
 	enum htbl_flags *col_data, enum htbl_flags header_flag)
@@ -3055,9 +3819,12 @@ parse_table_row(struct lowdown_buf *ob, struct lowdown_doc *doc,
 		nn->rndr_table_cell.col = col;
 		nn->rndr_table_cell.columns = columns;
 
-		parse_inline(doc, data + cell_start, 
+		parse_inline_lazy(doc, data + cell_start, 
 			1 + cell_end - cell_start);
 		popnode(doc, nn);
+		if (doc->ext_flags & LOWDOWN_SRCPOS)
+			srcpos_set(doc, nn, data + cell_start,
+				data + cell_end + 1);
 		i++;
 	}
 
@@ -3071,6 +3838,9 @@ parse_table_row(struct lowdown_buf *ob, struct lowdown_doc *doc,
 	}
 
 	popnode(doc, n);
+	if (doc->ext_flags & LOWDOWN_SRCPOS)
+		srcpos_set(doc, n, data, data + size);
+	return n;
 }
 
 static size_t
@@ -3175,10 +3945,10 @@ parse_table_header(struct lowdown_node **np,
 static size_t
 parse_table(struct lowdown_doc *doc, char *data, size_t size)
 {
-	size_t		 	 i, columns, row_start, pipes;
+	size_t		 	 i, columns, row_start, pipes, links;
 	struct lowdown_buf 	*header_work = NULL, *body_work = NULL;
 	enum htbl_flags		*col_data = NULL;
-	struct lowdown_node	*n = NULL, *nn;
+	struct lowdown_node	*n = NULL, *nn, *row;
 
 	header_work = hbuf_new(64);
 	body_work = hbuf_new(256);
@@ -3189,22 +3959,42 @@ parse_table(struct lowdown_doc *doc, char *data, size_t size)
 	if (i > 0) {
 		nn = pushnode(doc, LOWDOWN_TABLE_BODY);
 		while (i < size) {
-			pipes = 0;
+			pipes = links = 0;
 			row_start = i;
 
-			while (i < size && data[i] != '\n')
-				if (data[i++] == '|')
+			for ( ; i < size && data[i] != '\n'; i++)
+				if (data[i] == '|')
 					pipes++;
+				else if (data[i] == '[')
+					links++;
 
 			if (pipes == 0 || i == size) {
 				i = row_start;
 				break;
 			}
 
-			parse_table_row(body_work,
-				doc, data + row_start,
-				i - row_start, columns,
-				col_data, 0);
+			/*
+			 * In compact mode, keep the raw row and let
+			 * table_row_expand() parse it when rendered
+			 * or, with lowdown_doc_events(), emitted.
+			 * Rows possibly with links, images, or
+			 * footnotes are parsed now: they depend upon
+			 * references and the footnote count.
+			 */
+
+			if ((doc->render || doc->events != NULL) &&
+			    !(doc->ext_flags & LOWDOWN_SRCPOS) &&
+			    links == 0) {
+				row = pushnode(doc, LOWDOWN_TABLE_ROW);
+				pushspan(&row->rndr_table_row.text,
+					data + row_start, i - row_start);
+				row->rndr_table_row.doc = doc;
+				popnode(doc, row);
+			} else
+				parse_table_row(body_work,
+					doc, data + row_start,
+					i - row_start, columns,
+					col_data, 0);
 
 			i++;
 		}
@@ -3219,6 +4009,96 @@ parse_table(struct lowdown_doc *doc, char *data, size_t size)
 	return i;
 }
 
+/*
+ * If "row" is a compact table row, parse it into a new row with cells
+ * as if it had been parsed in place, smartypants and all.
+ * The new row is not part of the tree but shares its parent and
+ * sibling pointers, so it may be rendered in place of "row".
+ * Returns NULL if "row" isn't compact, otherwise the new row, which
+ * must be freed with lowdown_node_free().
+ */
+struct lowdown_node *
+table_row_expand(const struct lowdown_node *row)
+{
+	struct lowdown_doc		*doc;
+	const struct lowdown_node	*hdr;
+	struct lowdown_node		*cur, *exp;
+	size_t				 depth;
+
+	if (row->type != LOWDOWN_TABLE_ROW ||
+	    (doc = row->rndr_table_row.doc) == NULL)
+		return NULL;
+
+	/* Body's parent is the table, whose first child the header. */
+
+	assert(row->parent != NULL && row->parent->parent != NULL);
+	hdr = TAILQ_FIRST(&row->parent->parent->children);
+	assert(hdr != NULL && hdr->type == LOWDOWN_TABLE_HEADER);
+
+	/* Parse at the row's depth for the same maximum depth. */
+
+	cur = doc->current;
+	depth = doc->depth;
+	doc->current = NULL;
+	doc->depth = node_depth(row->parent);
+
+	exp = parse_table_row(NULL, doc, row->rndr_table_row.text.data,
+		row->rndr_table_row.text.size, hdr->rndr_table_header.columns,
+		hdr->rndr_table_header.flags, 0);
+
+	doc->current = cur;
+	doc->depth = depth;
+
+	exp->id = row->id;
+	exp->parent = row->parent;
+	exp->entries = row->entries;
+
+	return exp;
+}
+
+/*
+ * Whether the unparsed inline span "data" of "size" bytes may contain
+ * links, autolinks, or images.
+ * Unparsed spans have no '[', so only autolinks in angle brackets or,
+ * with LOWDOWN_AUTOLINK, bare ones are possible.
+ */
+static int
+span_links(const struct lowdown_doc *doc, const char *data, size_t size)
+{
+
+	if (memchr(data, '<', size) != NULL)
+		return 1;
+	if (!(doc->ext_flags & LOWDOWN_AUTOLINK))
+		return 0;
+	return memchr(data, '@', size) != NULL ||
+		memmem(data, size, "://", 3) != NULL ||
+		memmem(data, size, "www.", 4) != NULL;
+}
+
+/*
+ * If "row" is a compact table row that may contain links, replace it in
+ * the tree with its expansion (see table_row_expand()) and return that.
+ * Otherwise, return "row" as-is.
+ */
+const struct lowdown_node *
+table_row_links(const struct lowdown_node *row)
+{
+	struct lowdown_node	*n = (struct lowdown_node *)row, *exp;
+
+	if (row->type != LOWDOWN_TABLE_ROW ||
+	    row->rndr_table_row.doc == NULL ||
+	    !span_links(row->rndr_table_row.doc,
+	     row->rndr_table_row.text.data,
+	     row->rndr_table_row.text.size))
+		return row;
+
+	exp = table_row_expand(row);
+	TAILQ_INSERT_BEFORE(n, exp, entries);
+	TAILQ_REMOVE(&n->parent->children, n, entries);
+	lowdown_node_free(n);
+	return exp;
+}
+
 /* 
  * Parsing of one block, returning next char to parse.
  * We can assume, entering the block, that our output is newline
@@ -3227,10 +4107,19 @@ parse_table(struct lowdown_doc *doc, char *data, size_t size)
 static void
 parse_block(struct lowdown_doc *doc, char *data, size_t size)
 {
-	size_t	 		 beg = 0, end, i;
+	size_t	 		 beg = 0, end, i, start = 0;
 	char			*txt_data;
 	char			 oli_data[10];
-	struct lowdown_node	*n;
+	struct lowdown_node	*n, *last = NULL;
+	size_t			 gen = doc->blockgen;
+
+	/*
+	 * Give each invocation its own generation, restoring the
+	 * caller's on exit, so the HTML block caches of nested blocks
+	 * (with different buffers) don't mix.
+	 */
+
+	doc->blockgen = ++doc->blockgens;
 
 	/* 
 	 * What kind of block are we?
@@ -3238,6 +4127,13 @@ parse_block(struct lowdown_doc *doc, char *data, size_t size)
 	 */
 
 	while (beg < size) {
+		if (doc->ext_flags & LOWDOWN_SRCPOS) {
+			srcpos_block(doc, last, data + start, data + beg);
+			last = TAILQ_LAST
+				(&doc->current->children, lowdown_nodeq);
+			start = beg;
+		}
+
 		txt_data = data + beg;
 		end = size - beg;
 
@@ -3343,6 +4239,12 @@ parse_block(struct lowdown_doc *doc, char *data, size_t size)
 
 		beg += parse_paragraph(doc, txt_data, end);
 	}
+
+	if (doc->ext_flags & LOWDOWN_SRCPOS)
+		srcpos_block(doc, last, data + start,
+			data + (beg < size ? beg : size));
+
+	doc->blockgen = gen;
 }
 
 /* 
@@ -3359,6 +4261,7 @@ is_footnote(struct lowdown_doc *doc, const char *data,
 	struct lowdown_buf	*contents = NULL;
 	int			 in_empty = 0;
 	struct footnote_ref	*ref;
+	struct srcmap		*map;
 
 	/* up to 3 optional leading spaces */
 
@@ -3392,6 +4295,8 @@ is_footnote(struct lowdown_doc *doc, const char *data,
 	/* getting content buffer */
 
 	contents = hbuf_new(64);
+	map = (doc->ext_flags & LOWDOWN_SRCPOS) ?
+		xcalloc(1, sizeof(struct srcmap)) : NULL;
 
 	start = i;
 
@@ -3429,19 +4334,21 @@ is_footnote(struct lowdown_doc *doc, const char *data,
 			} else 
 				break;
 		} else if (in_empty) {
-			hbuf_putc(contents, '\n');
+			srcmap_putc(doc, map, contents,
+				'\n', data + start - 1);
 		}
 
 		in_empty = 0;
 
 		/* adding the line into the content buffer */
 
-		hbuf_put(contents, data + start + ind, i - start - ind);
+		srcmap_put(doc, map, contents,
+			data + start + ind, i - start - ind);
 
 		/* add carriage return */
 
 		if (i < end) {
-			hbuf_putc(contents, '\n');
+			srcmap_putc(doc, map, contents, '\n', data + i);
 			if (i < end && 
 			    (data[i] == '\n' || data[i] == '\r')) {
 				i++;
@@ -3459,6 +4366,7 @@ is_footnote(struct lowdown_doc *doc, const char *data,
 	ref = xcalloc(1, sizeof(struct footnote_ref));
 	TAILQ_INSERT_TAIL(&doc->footnotes, ref, entries);
 	ref->contents = contents;
+	ref->map = map;
 	if (id_end - id_offset) {
 		ref->name = hbuf_new(id_end - id_offset);
 		hbuf_put(ref->name, data + id_offset, id_end - id_offset);
@@ -3600,6 +4508,7 @@ is_ref(struct lowdown_doc *doc, const char *data,
 		ref->name = hbuf_new(id_end - id_offset);
 		hbuf_put(ref->name, data + id_offset, id_end - id_offset);
 	}
+	bin_link_ref(doc, ref);
 	ref->link = hbuf_new(link_end - link_offset);
 	hbuf_put(ref->link, data + link_offset, link_end - link_offset);
 
@@ -3612,7 +4521,8 @@ is_ref(struct lowdown_doc *doc, const char *data,
 }
 
 static void 
-expand_tabs(struct lowdown_buf *ob, const char *line, size_t size)
+expand_tabs(struct lowdown_buf *ob, const char *line, size_t size,
+	struct srcmap *map)
 {
 	size_t  i = 0, tab = 0, org;
 
@@ -3636,12 +4546,17 @@ expand_tabs(struct lowdown_buf *ob, const char *line, size_t size)
 			i++;
 		}
 
-		if (i > org)
+		if (i > org) {
+			if (map != NULL)
+				srcmap_add(map, ob->size, line + org, i - org);
 			hbuf_put(ob, line + org, i - org);
+		}
 
 		if (i >= size)
 			break;
 
+		if (map != NULL)
+			srcmap_add(map, ob->size, line + i, 0);
 		do {
 			hbuf_putc(ob, ' '); 
 			tab++;
@@ -3683,12 +4598,174 @@ lowdown_doc_new(const struct lowdown_opts *opts)
 	if (extensions & LOWDOWN_MATH)
 		doc->active_char['$'] = MD_CHAR_MATH;
 
+	/* Lazy content would be parsed without its source. */
+
+	if (extensions & LOWDOWN_SRCPOS)
+		extensions &= ~LOWDOWN_LAZY;
+	if (extensions & LOWDOWN_INTERN)
+		doc->strs = hstrtab_new();
+
 	doc->opts = opts;
 	doc->ext_flags = extensions;
 
 	return doc;
 }
 
+/*
+ * Have "doc" intern strings in the table of "from", if both are
+ * interning, so equal strings in both of their trees share storage.
+ */
+void
+doc_share_strings(struct lowdown_doc *doc, const struct lowdown_doc *from)
+{
+
+	if (doc->strs == NULL || from->strs == NULL)
+		return;
+	hstrtab_free(doc->strs);
+	doc->strs = hstrtab_ref(from->strs);
+}
+
+/*
+ * Mark "doc" as parsing for lowdown_buf(), which renders while the
+ * document is still around: parse_table() keeps body rows raw for
+ * table_row_expand(), and content parsed while rendering is run
+ * through the doc_pass() transforms, as the tree already has been.
+ * The document must not be freed until rendering completes.
+ */
+void
+doc_render(struct lowdown_doc *doc)
+{
+
+	doc->render = 1;
+}
+
+/*
+ * Merge adjacent text children of "n" into single text nodes, freeing
+ * the duplicates along the way.
+ * This is only used when diffing, as it makes the diff algorithm have
+ * a more reasonable view of text in the tree.
+ */
+static int
+pass_merge_text(struct lowdown_doc *doc, struct lowdown_node *n)
+{
+	struct lowdown_node 	*nn, *next;
+	struct lowdown_buf	*nb, *nextbuf;
+	struct lowdown_pos	*pos;
+	const struct lowdown_pos *npos;
+
+	TAILQ_FOREACH(nn, &n->children, entries) {
+		if (nn->type != LOWDOWN_NORMAL_TEXT)
+			continue;
+		nb = &nn->rndr_normal_text.text;
+		while ((next = TAILQ_NEXT(nn, entries)) != NULL &&
+		    next->type == LOWDOWN_NORMAL_TEXT) {
+			nextbuf = &next->rndr_normal_text.text;
+			TAILQ_REMOVE(&n->children, next, entries);
+			nb->data = xrealloc(nb->data, 
+				nb->size + nextbuf->size + 1);
+			memcpy(nb->data + nb->size,
+				nextbuf->data, nextbuf->size);
+			nb->data[nb->size + nextbuf->size] = '\0';
+			nb->size += nextbuf->size;
+			if (doc->ext_flags & LOWDOWN_SRCPOS) {
+				pos = srcpos_get(doc, nn);
+				npos = srcpos_get(doc, next);
+				if (pos->line != 0 && npos->line != 0) {
+					pos->len = npos->off +
+						npos->len - pos->off;
+					pos->lines = npos->line +
+						npos->lines - pos->line;
+				}
+			}
+			lowdown_node_free(next);
+		}
+	}
+	return 1;
+}
+
+static int
+pass_smarty(struct lowdown_doc *doc, struct lowdown_node *n)
+{
+
+	return smarty_node(n, &doc->nodes);
+}
+
+/*
+ * Per-node hooks of the transforms registered with doc_pass().
+ * Each returns non-zero if it must also be run over the node's
+ * descendants, or zero if it has already seen to them.
+ */
+static int (*const passes[DOC_PASS__MAX])(struct lowdown_doc *,
+	struct lowdown_node *) = {
+	pass_merge_text, /* DOC_PASS_MERGE_TEXT */
+	pass_smarty, /* DOC_PASS_SMARTY */
+};
+
+/*
+ * Register transform "pass" to be run over the parsed tree.
+ * Rather than each walking the tree, all transforms are run on each
+ * node in a single walk at the end of lowdown_doc_parse().
+ * Content parsed later (LOWDOWN_LAZY and compact table rows) is run as
+ * the parser finishes each of its nodes (see popnode()).
+ */
+void
+doc_pass(struct lowdown_doc *doc, enum doc_pass pass)
+{
+
+	doc->passes |= 1U << pass;
+}
+
+/*
+ * Run the registered transforms over "n".
+ * Returns non-zero if any must be run over its descendants.
+ */
+static int
+doc_pass_run(struct lowdown_doc *doc, struct lowdown_node *n)
+{
+	size_t	 i;
+	int	 descend = 0;
+
+	for (i = 0; i < DOC_PASS__MAX; i++)
+		if (doc->passes & (1U << i))
+			descend |= passes[i](doc, n);
+	return descend;
+}
+
+/*
+ * Run the registered transforms over "root" and its descendants in a
+ * single walk by parent pointers.
+ * Each node is run before its children, so transforms may add or
+ * remove children as they go.
+ * Nodes without children are skipped, as no transform acts on them.
+ * With smartypants, the walk fires the smarty__start and smarty__done
+ * probes that smarty() otherwise would.
+ */
+static void
+doc_pass_tree(struct lowdown_doc *doc, struct lowdown_node *root)
+{
+	struct lowdown_node	*n = root;
+	int			 smarty;
+
+	smarty = (doc->passes & (1U << DOC_PASS_SMARTY)) != 0;
+	if (smarty)
+		LOWDOWN_PROBE1(smarty__start, doc->nodes);
+
+	for (;;) {
+		if (!TAILQ_EMPTY(&n->children) && doc_pass_run(doc, n)) {
+			n = TAILQ_FIRST(&n->children);
+			continue;
+		}
+		while (n != root && TAILQ_NEXT(n, entries) == NULL)
+			n = n->parent;
+		if (n == root)
+			break;
+		n = TAILQ_NEXT(n, entries);
+	}
+
+	if (smarty)
+		LOWDOWN_PROBE1(smarty__done, doc->nodes);
+}
+
 /*
  * Parse a MMD meta-data value.
  * If the value is a single line, both leading and trailing whitespace
@@ -3900,10 +4977,26 @@ lowdown_doc_parse(struct lowdown_doc *doc,
 	const char		*sv;
 	struct lowdown_node 	*n, *root;
 	struct hbufn		*m;
+	struct srcmap		 textmap, *map = NULL;
+
+	LOWDOWN_PROBE1(doc__start, size);
 
 	doc->depth = 0;
 	doc->current = NULL;
 	doc->in_link_body = 0;
+	doc->parsed = 0;
+
+	/*
+	 * For node positions, index the input's lines and map the
+	 * text we parse (less references, with tabs expanded and
+	 * newlines normalised) back to the input.
+	 */
+
+	memset(&textmap, 0, sizeof(struct srcmap));
+	if (doc->ext_flags & LOWDOWN_SRCPOS) {
+		srcpos_lines(doc, data, size);
+		map = &textmap;
+	}
 
 	text = hbuf_new(64);
 	root = pushnode(doc, LOWDOWN_ROOT);
@@ -3970,14 +5063,16 @@ lowdown_doc_parse(struct lowdown_doc *doc,
 
 			/* Adding the line body if present. */
 			if (end > beg)
-				expand_tabs(text, data + beg, end - beg);
+				expand_tabs(text, data + beg,
+					end - beg, map);
 
 			while (end < size && (data[end] == '\n' ||
 			       data[end] == '\r')) {
 				/* Add one \n per newline. */
 				if (data[end] == '\n' ||
 				    (end + 1 < size && data[end + 1] != '\n'))
-					hbuf_putc(text, '\n');
+					srcmap_putc(doc, &textmap,
+						text, '\n', data + end);
 				end++;
 			}
 
@@ -3992,8 +5087,11 @@ lowdown_doc_parse(struct lowdown_doc *doc,
 		/* Adding a final newline if not already present. */
 		if (text->data[text->size - 1] != '\n' &&
 		    text->data[text->size - 1] != '\r')
-			hbuf_putc(text, '\n');
+			srcmap_putc(doc, &textmap,
+				text, '\n', data + size - 1);
+		srcmap_push(doc, &textmap, text->data, text->size);
 		parse_block(doc, text->data, text->size);
+		srcmap_pop(doc, &textmap);
 	}
 
 	/* Footnotes. */
@@ -4006,85 +5104,362 @@ lowdown_doc_parse(struct lowdown_doc *doc,
 	/* Clean-up. */
 
 	hbuf_free(text);
-	free_link_refs(&doc->refq);
+	free(textmap.segs);
+	free_link_refs(doc);
 	free_footnote_refs(&doc->footnotes);
+	free(doc->lines);
+	doc->lines = NULL;
+	doc->linesz = 0;
+	doc->src = NULL;
 
 	while ((m = TAILQ_FIRST(&doc->metaq)) != NULL) {
 		TAILQ_REMOVE(&doc->metaq, m, entries);
 		free(m);
 	}
 
+	popnode(doc, root);
+	assert(doc->depth == 0);
+
+	if (doc->passes)
+		doc_pass_tree(doc, root);
+	doc->parsed = 1;
+	doc->root = NULL;
+
 	if (maxn != NULL)
 		*maxn = doc->nodes;
 
-	popnode(doc, root);
-	assert(doc->depth == 0);
+	LOWDOWN_PROBE2(doc__done, size, doc->nodes);
 	return root;
 }
 
-void
-lowdown_node_free(struct lowdown_node *root)
+/*
+ * Emit the events for "n" and its children.
+ */
+static void
+events_node(const struct lowdown_events *ev, const struct lowdown_node *n)
 {
-	struct lowdown_node *n;
+	const struct lowdown_node	*child;
+	const struct lowdown_buf	*text;
+	struct lowdown_node		*row;
 
-	if (root == NULL)
+	if ((row = table_row_expand(n)) != NULL) {
+		events_node(ev, row);
+		lowdown_node_free(row);
 		return;
+	}
+
+	if (ev->enter != NULL)
+		ev->enter(ev->arg, n);
+
+	switch (n->type) {
+	case LOWDOWN_BLOCKCODE:
+		text = &n->rndr_blockcode.text;
+		break;
+	case LOWDOWN_CODESPAN:
+		text = &n->rndr_codespan.text;
+		break;
+	case LOWDOWN_MATH_BLOCK:
+		text = &n->rndr_math.text;
+		break;
+	case LOWDOWN_NORMAL_TEXT:
+		text = &n->rndr_normal_text.text;
+		break;
+	default:
+		text = NULL;
+		break;
+	}
+	if (text != NULL && ev->text != NULL)
+		ev->text(ev->arg, n, text);
+
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		events_node(ev, child);
+
+	if (ev->leave != NULL)
+		ev->leave(ev->arg, n);
+}
+
+/*
+ * Emit the events for and free the children of "root" but for the last
+ * "keep", which may still be modified by the parse.
+ */
+static void
+events_flush(struct lowdown_doc *doc, struct lowdown_node *root,
+	size_t keep)
+{
+	struct lowdown_node	*n, *nn;
+	size_t			 i;
+
+	while ((n = TAILQ_FIRST(&root->children)) != NULL) {
+		for (nn = n, i = 0; nn != NULL && i < keep; i++)
+			nn = TAILQ_NEXT(nn, entries);
+		if (nn == NULL)
+			break;
+		TAILQ_REMOVE(&root->children, n, entries);
+		events_node(doc->events, n);
+		lowdown_node_free(n);
+	}
+}
+
+/*
+ * Parse the document as lowdown_doc_parse() does, but instead of
+ * returning the tree, emit events for each node in document order.
+ * Each top-level block is freed once its events are emitted, so the
+ * tree never holds more than a few of them, and table body rows are
+ * only parsed as they're emitted.
+ */
+void
+lowdown_doc_events(struct lowdown_doc *doc,
+	const struct lowdown_events *ev, const char *data, size_t size)
+{
+	struct lowdown_node	*root;
+
+	doc->events = ev;
+	root = lowdown_doc_parse(doc, NULL, data, size);
+	events_flush(doc, root, 0);
+	if (ev->leave != NULL)
+		ev->leave(ev->arg, root);
+	lowdown_node_free(root);
+	doc->events = NULL;
+}
+
+/*
+ * Return the children of "n", first parsing them if they were left
+ * unparsed with LOWDOWN_LAZY.
+ * This is the only modification made to "n", so it may be called on
+ * nodes otherwise considered constant.
+ */
+const struct lowdown_nodeq *
+lowdown_node_children(const struct lowdown_node *n)
+{
+	struct lowdown_node	*nn = (struct lowdown_node *)n, *cur;
+	struct lowdown_lazy	**lazyp = node_lazy(n), *lazy;
+	struct lowdown_doc	*doc;
+	size_t			 depth;
+
+	if (lazyp == NULL || (lazy = *lazyp) == NULL)
+		return &n->children;
+
+	*lazyp = NULL;
+	doc = lazy->doc;
+	cur = doc->current;
+	depth = doc->depth;
+	doc->current = nn;
+	doc->depth = node_depth(n);
+	parse_inline(doc, lazy->text.data, lazy->text.size);
+	doc->current = cur;
+	doc->depth = depth;
+
+	if (doc->passes)
+		doc_pass_run(doc, nn);
+	hbuf_free(&lazy->text);
+	free(lazy);
+	return &n->children;
+}
+
+/*
+ * Fill "pos" with the input position of "n", looked up in the table of
+ * the root of its tree.
+ * Returns zero (with "pos" zeroed) if "n" has none: it wasn't parsed
+ * with LOWDOWN_SRCPOS, isn't from the input, or isn't in a tree.
+ */
+int
+lowdown_node_pos(const struct lowdown_node *n, struct lowdown_pos *pos)
+{
+	const struct lowdown_node	*root;
+	size_t				 i;
+
+	memset(pos, 0, sizeof(struct lowdown_pos));
+	for (root = n; root->parent != NULL; root = root->parent)
+		continue;
+	if (root->type != LOWDOWN_ROOT)
+		return 0;
+	i = n->id - root->id;
+	if (i >= root->rndr_root.posz)
+		return 0;
+	*pos = root->rndr_root.pos[i];
+	return pos->line != 0;
+}
+
+/*
+ * Start iterating over "root" and its descendants with
+ * lowdown_iter_next().
+ */
+void
+lowdown_iter_init(struct lowdown_iter *it, const struct lowdown_node *root)
+{
+
+	it->root = root;
+	it->node = NULL;
+	it->event = LOWDOWN_ITER_DONE;
+}
+
+/*
+ * Advance to the next node, returning LOWDOWN_ITER_ENTER when first
+ * visiting it (pre-order), LOWDOWN_ITER_LEAVE after its children
+ * (post-order), or LOWDOWN_ITER_DONE after leaving the root.
+ * The node is in "it->node".
+ * Nodes without children are entered then immediately left.
+ */
+enum lowdown_iter_event
+lowdown_iter_next(struct lowdown_iter *it)
+{
+	const struct lowdown_node	*n = it->node, *next;
+
+	switch (it->event) {
+	case LOWDOWN_ITER_DONE:
+		if (n != NULL || it->root == NULL)
+			return LOWDOWN_ITER_DONE;
+		it->node = it->root;
+		return it->event = LOWDOWN_ITER_ENTER;
+	case LOWDOWN_ITER_ENTER:
+		if ((next = TAILQ_FIRST(lowdown_node_children(n))) != NULL) {
+			it->node = next;
+			return LOWDOWN_ITER_ENTER;
+		}
+		return it->event = LOWDOWN_ITER_LEAVE;
+	case LOWDOWN_ITER_LEAVE:
+		if (n == it->root)
+			return it->event = LOWDOWN_ITER_DONE;
+		if ((next = TAILQ_NEXT(n, entries)) != NULL) {
+			it->node = next;
+			return it->event = LOWDOWN_ITER_ENTER;
+		}
+		it->node = n->parent;
+		return LOWDOWN_ITER_LEAVE;
+	}
+
+	abort();
+}
+
+/*
+ * Whether the children of "n" may contain links, autolinks, or images.
+ * This is only false if they were left unparsed with LOWDOWN_LAZY and
+ * the span can't have any, or if "n" is a compact table row (see
+ * table_row_links()).
+ */
+int
+lazy_links(const struct lowdown_node *n)
+{
+	struct lowdown_lazy	**lazy;
 
-	switch (root->type) {
+	if (n->type == LOWDOWN_TABLE_ROW &&
+	    n->rndr_table_row.doc != NULL)
+		return 0;
+	if ((lazy = node_lazy(n)) == NULL || *lazy == NULL)
+		return 1;
+	return span_links((*lazy)->doc,
+		(*lazy)->text.data, (*lazy)->text.size);
+}
+
+/*
+ * Free the contents of "n", but neither its children nor "n" itself.
+ */
+static void
+node_free_data(struct lowdown_node *n)
+{
+	struct lowdown_lazy	**lazy;
+
+	switch (n->type) {
+	case LOWDOWN_ROOT:
+		free(n->rndr_root.pos);
+		break;
 	case LOWDOWN_META:
-		hbuf_free(&root->rndr_meta.key);
+		hbuf_free(&n->rndr_meta.key);
 		break;
 	case LOWDOWN_NORMAL_TEXT:
-		hbuf_free(&root->rndr_normal_text.text);
+		hbuf_free(&n->rndr_normal_text.text);
 		break;
 	case LOWDOWN_CODESPAN:
-		hbuf_free(&root->rndr_codespan.text);
+		hbuf_free(&n->rndr_codespan.text);
 		break;
 	case LOWDOWN_ENTITY:
-		hbuf_free(&root->rndr_entity.text);
+		hbuf_free(&n->rndr_entity.text);
 		break;
 	case LOWDOWN_LINK_AUTO:
-		hbuf_free(&root->rndr_autolink.text);
-		hbuf_free(&root->rndr_autolink.link);
+		hbuf_free(&n->rndr_autolink.text);
+		hbuf_free(&n->rndr_autolink.link);
 		break;
 	case LOWDOWN_RAW_HTML:
-		hbuf_free(&root->rndr_raw_html.text);
+		hbuf_free(&n->rndr_raw_html.text);
 		break;
 	case LOWDOWN_LINK:
-		hbuf_free(&root->rndr_link.link);
-		hbuf_free(&root->rndr_link.title);
+		hbuf_free(&n->rndr_link.link);
+		hbuf_free(&n->rndr_link.title);
 		break;
 	case LOWDOWN_BLOCKCODE:
-		hbuf_free(&root->rndr_blockcode.text);
-		hbuf_free(&root->rndr_blockcode.lang);
+		hbuf_free(&n->rndr_blockcode.text);
+		hbuf_free(&n->rndr_blockcode.lang);
 		break;
 	case LOWDOWN_BLOCKHTML:
-		hbuf_free(&root->rndr_blockhtml.text);
+		hbuf_free(&n->rndr_blockhtml.text);
 		break;
 	case LOWDOWN_TABLE_HEADER:
-		free(root->rndr_table_header.flags);
+		free(n->rndr_table_header.flags);
+		break;
+	case LOWDOWN_TABLE_ROW:
+		hbuf_free(&n->rndr_table_row.text);
 		break;
 	case LOWDOWN_IMAGE:
-		hbuf_free(&root->rndr_image.link);
-		hbuf_free(&root->rndr_image.title);
-		hbuf_free(&root->rndr_image.dims);
-		hbuf_free(&root->rndr_image.alt);
-		hbuf_free(&root->rndr_image.attr_width);
-		hbuf_free(&root->rndr_image.attr_height);
+		hbuf_free(&n->rndr_image.link);
+		hbuf_free(&n->rndr_image.title);
+		hbuf_free(&n->rndr_image.dims);
+		hbuf_free(&n->rndr_image.alt);
+		hbuf_free(&n->rndr_image.attr_width);
+		hbuf_free(&n->rndr_image.attr_height);
 		break;
 	case LOWDOWN_MATH_BLOCK:
-		hbuf_free(&root->rndr_math.text);
+		hbuf_free(&n->rndr_math.text);
 		break;
 	default:
 		break;
 	}
 
-	while ((n = TAILQ_FIRST(&root->children)) != NULL) {
-		TAILQ_REMOVE(&root->children, n, entries);
-		lowdown_node_free(n);
+	if ((lazy = node_lazy(n)) != NULL && *lazy != NULL) {
+		hbuf_free(&(*lazy)->text);
+		free(*lazy);
 	}
+}
+
+/*
+ * Free "root" and its descendants.
+ * This walks the tree by parent pointers, freeing each node after its
+ * children, so it uses constant space whatever the tree's depth.
+ * The parent pointer of "root" itself is never used, as it may be a
+ * subtree that has already been unlinked.
+ */
+void
+lowdown_node_free(struct lowdown_node *root)
+{
+	struct lowdown_node	*n, *nn, *next;
+
+	if (root == NULL)
+		return;
+
+	n = root;
+	for (;;) {
+		while ((nn = TAILQ_FIRST(&n->children)) != NULL)
+			n = nn;
 
-	free(root);
+		/*
+		 * Free "n", whose children are freed, then continue with
+		 * its next sibling or, if none, its parent.
+		 */
+
+		for (;;) {
+			next = TAILQ_NEXT(n, entries);
+			nn = n->parent;
+			node_free_data(n);
+			if (n == root) {
+				free(n);
+				return;
+			}
+			free(n);
+			if (next != NULL)
+				break;
+			n = nn;
+		}
+		n = next;
+	}
 }
 
 void
@@ -4107,5 +5482,8 @@ void
 lowdown_doc_free(struct lowdown_doc *doc)
 {
 
+	if (doc == NULL)
+		return;
+	hstrtab_free(doc->strs);
 	free(doc);
 }
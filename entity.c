@@ -403,6 +403,41 @@ entity_find_iso(const struct lowdown_buf *buf)
 	return e->unicode;
 }
 
+/*
+ * Output the unicode entry "val", which must be strictly greater than
+ * zero, as a UTF-8 sequence.
+ * Surrogates and values beyond the unicode range are not output.
+ */
+void
+entity_utf8(struct lowdown_buf *buf, int32_t val)
+{
+
+	assert(val > 0);
+	if (val < 0x80) {
+		hbuf_putc(buf, val);
+		return;
+	}
+	if (val < 0x800) {
+		hbuf_putc(buf, 192 + val / 64);
+		hbuf_putc(buf, 128 + val % 64);
+		return;
+	}
+	if (val - 0xd800u < 0x800)
+		return;
+	if (val < 0x10000) {
+		hbuf_putc(buf, 224 + val / 4096);
+		hbuf_putc(buf, 128 + val / 64 % 64);
+		hbuf_putc(buf, 128 + val % 64);
+		return;
+	}
+	if (val < 0x110000) {
+		hbuf_putc(buf, 240 + val / 262144);
+		hbuf_putc(buf, 128 + val / 4096 % 64);
+		hbuf_putc(buf, 128 + val / 64 % 64);
+		hbuf_putc(buf, 128 + val % 64);
+	}
+}
+
 /*
  * Looks for the TeX entity corresponding to "buf".
  * If "buf" is a numerical code, looks it up by number; if an HTML (ISO)
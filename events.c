@@ -0,0 +1,211 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lowdown.h"
+#include "extern.h"
+
+/*
+ * Print the lowdown_doc_events() of a document, one per line and
+ * indented by depth, for the regression suite.
+ * With -l, parse with LOWDOWN_LAZY.
+ * With -p, parse with LOWDOWN_SRCPOS and print the position of each
+ * node entered.
+ */
+
+static	const char *const names[LOWDOWN__MAX] = {
+	"LOWDOWN_ROOT",
+	"LOWDOWN_BLOCKCODE",
+	"LOWDOWN_BLOCKQUOTE",
+	"LOWDOWN_DEFINITION",
+	"LOWDOWN_DEFINITION_TITLE",
+	"LOWDOWN_DEFINITION_DATA",
+	"LOWDOWN_HEADER",
+	"LOWDOWN_HRULE",
+	"LOWDOWN_LIST",
+	"LOWDOWN_LISTITEM",
+	"LOWDOWN_PARAGRAPH",
+	"LOWDOWN_TABLE_BLOCK",
+	"LOWDOWN_TABLE_HEADER",
+	"LOWDOWN_TABLE_BODY",
+	"LOWDOWN_TABLE_ROW",
+	"LOWDOWN_TABLE_CELL",
+	"LOWDOWN_FOOTNOTES_BLOCK",
+	"LOWDOWN_FOOTNOTE_DEF",
+	"LOWDOWN_BLOCKHTML",
+	"LOWDOWN_LINK_AUTO",
+	"LOWDOWN_CODESPAN",
+	"LOWDOWN_DOUBLE_EMPHASIS",
+	"LOWDOWN_EMPHASIS",
+	"LOWDOWN_HIGHLIGHT",
+	"LOWDOWN_IMAGE",
+	"LOWDOWN_LINEBREAK",
+	"LOWDOWN_LINK",
+	"LOWDOWN_TRIPLE_EMPHASIS",
+	"LOWDOWN_STRIKETHROUGH",
+	"LOWDOWN_SUPERSCRIPT",
+	"LOWDOWN_FOOTNOTE_REF",
+	"LOWDOWN_MATH_BLOCK",
+	"LOWDOWN_RAW_HTML",
+	"LOWDOWN_ENTITY",
+	"LOWDOWN_NORMAL_TEXT",
+	"LOWDOWN_DOC_HEADER",
+	"LOWDOWN_META",
+	"LOWDOWN_DOC_FOOTER",
+};
+
+struct	state {
+	size_t	 depth; /* nodes entered and not left */
+	int	 pos; /* print positions */
+};
+
+static void
+indent(const struct state *st)
+{
+	size_t	 i;
+
+	for (i = 0; i < st->depth; i++)
+		fputs("  ", stdout);
+}
+
+static void
+enter(void *arg, const struct lowdown_node *n)
+{
+	struct state		*st = arg;
+	struct lowdown_pos	 pos;
+
+	indent(st);
+	printf("enter %s", names[n->type]);
+	if (st->pos && lowdown_node_pos(n, &pos))
+		printf(" (lines %u-%u, bytes %u-%u)",
+			pos.line, pos.line + pos.lines,
+			pos.off, pos.off + pos.len);
+	putchar('\n');
+	st->depth++;
+}
+
+static void
+text(void *arg, const struct lowdown_node *n,
+	const struct lowdown_buf *b)
+{
+	struct state	*st = arg;
+	size_t		 i;
+
+	indent(st);
+	fputs("text \"", stdout);
+	for (i = 0; i < b->size; i++)
+		if (b->data[i] == '\n')
+			fputs("\\n", stdout);
+		else
+			putchar(b->data[i]);
+	fputs("\"\n", stdout);
+}
+
+static void
+leave(void *arg, const struct lowdown_node *n)
+{
+	struct state	*st = arg;
+
+	st->depth--;
+	indent(st);
+	printf("leave %s\n", names[n->type]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lowdown_opts	 opts;
+	struct lowdown_events	 ev;
+	struct lowdown_doc	*doc;
+	struct lowdown_buf	*in;
+	struct state		 st;
+	FILE			*f;
+	char			 buf[4096];
+	size_t			 sz;
+	int			 c;
+
+	memset(&opts, 0, sizeof(struct lowdown_opts));
+	memset(&st, 0, sizeof(struct state));
+
+	opts.maxdepth = 128;
+	opts.feat = LOWDOWN_FOOTNOTES |
+		LOWDOWN_AUTOLINK |
+		LOWDOWN_TABLES |
+		LOWDOWN_SUPER |
+		LOWDOWN_STRIKE |
+		LOWDOWN_FENCED |
+		LOWDOWN_COMMONMARK |
+		LOWDOWN_DEFLIST |
+		LOWDOWN_IMG_EXT |
+		LOWDOWN_METADATA;
+
+	while ((c = getopt(argc, argv, "lp")) != -1)
+		switch (c) {
+		case 'l':
+			opts.feat |= LOWDOWN_LAZY;
+			break;
+		case 'p':
+			opts.feat |= LOWDOWN_SRCPOS;
+			st.pos = 1;
+			break;
+		default:
+			goto usage;
+		}
+
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		goto usage;
+
+	if ((f = fopen(argv[0], "r")) == NULL)
+		err(EXIT_FAILURE, "%s", argv[0]);
+	in = hbuf_new(4096);
+	while ((sz = fread(buf, 1, sizeof(buf), f)) > 0)
+		hbuf_put(in, buf, sz);
+	if (ferror(f))
+		err(EXIT_FAILURE, "%s", argv[0]);
+	fclose(f);
+
+	memset(&ev, 0, sizeof(struct lowdown_events));
+	ev.enter = enter;
+	ev.text = text;
+	ev.leave = leave;
+	ev.arg = &st;
+
+	if ((doc = lowdown_doc_new(&opts)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	lowdown_doc_events(doc, &ev, in->data, in->size);
+	lowdown_doc_free(doc);
+	hbuf_free(in);
+	return EXIT_SUCCESS;
+usage:
+	fprintf(stderr, "usage: %s [-lp] file\n", getprogname());
+	return EXIT_FAILURE;
+}
@@ -26,17 +26,70 @@ char		*xstrndup(const char *, size_t);
 char		*xstrdup(const char *);
 
 void	 	 smarty(struct lowdown_node *, size_t, enum lowdown_type);
+int	 	 smarty_node(struct lowdown_node *, size_t *);
+
+/*
+ * Transforms run over the parsed tree in a single walk (see
+ * doc_pass()), in this order.
+ */
+enum	doc_pass {
+	DOC_PASS_MERGE_TEXT, /* merge adjacent text nodes */
+	DOC_PASS_SMARTY, /* smartypants */
+	DOC_PASS__MAX
+};
+
+void		 doc_pass(struct lowdown_doc *, enum doc_pass);
+void		 doc_render(struct lowdown_doc *);
+void		 doc_share_strings(struct lowdown_doc *,
+			const struct lowdown_doc *);
+int		 lazy_links(const struct lowdown_node *);
+int		 lazy_unparsed(const struct lowdown_node *);
+struct lowdown_node *table_row_expand(const struct lowdown_node *);
+const struct lowdown_node *table_row_links(const struct lowdown_node *);
+
+struct lowdown_node *library_diff(const struct lowdown_opts *,
+			const char *, size_t, const char *, size_t,
+			struct lowdown_node **, struct lowdown_node **);
+struct lowdown_node *library_parse(const struct lowdown_opts *,
+			struct lowdown_opts *, struct lowdown_doc **,
+			const char *, size_t);
+void		 library_rndr(struct lowdown_buf *, struct lowdown_metaq *,
+			const struct lowdown_opts *, struct lowdown_node *);
+
+void		 html_reset(void *);
+void		 html_header_id(struct lowdown_buf *, void *,
+			const struct lowdown_node *);
+
+enum	diff_phase {
+	DIFF_PHASE_SIGS, /* signatures and weights */
+	DIFF_PHASE_MATCH, /* priority-queue matching */
+	DIFF_PHASE_OPTIMISE, /* top-down and bottom-up optimisation */
+	DIFF_PHASE_MERGE, /* merging into the output tree */
+	DIFF_PHASE__MAX
+};
 
 int32_t	 	 entity_find_iso(const struct lowdown_buf *);
+void		 entity_utf8(struct lowdown_buf *, int32_t);
 const char	*entity_find_tex(const struct lowdown_buf *, unsigned char *);
 #define		 TEX_ENT_MATH	 0x01
 #define		 TEX_ENT_ASCII	 0x02
 
+struct hstrtab;
+
+/*
+ * Allocated size of a buffer sharing an interned string.
+ * See hbuf_intern().
+ */
+#define		 HBUF_SHARED ((size_t)-1)
+
 int		 hbuf_eq(const struct lowdown_buf *, const struct lowdown_buf *);
 int		 hbuf_streq(const struct lowdown_buf *, const char *);
 int		 hbuf_strprefix(const struct lowdown_buf *, const char *);
 void		 hbuf_free(struct lowdown_buf *);
 void		 hbuf_grow(struct lowdown_buf *, size_t);
+uint32_t	 hbuf_hash(const char *, size_t);
+void		 hbuf_intern(struct hstrtab *, struct lowdown_buf *,
+			const char *, size_t);
 struct lowdown_buf *hbuf_clone(const struct lowdown_buf *, struct lowdown_buf *);
 struct lowdown_buf *hbuf_new(size_t) __attribute__((malloc));
 void		 hbuf_printf(struct lowdown_buf *, const char *, ...) 
@@ -46,21 +99,63 @@ void		 hbuf_putb(struct lowdown_buf *, const struct lowdown_buf *);
 void		 hbuf_putc(struct lowdown_buf *, char);
 int		 hbuf_putf(struct lowdown_buf *, FILE *);
 void		 hbuf_puts(struct lowdown_buf *, const char *);
+void		 hbuf_putu(struct lowdown_buf *, uint64_t);
+void		 hbuf_putx(struct lowdown_buf *, uint64_t, size_t);
 void		 hbuf_truncate(struct lowdown_buf *);
+void		 hstrtab_free(struct hstrtab *);
+struct hstrtab	*hstrtab_new(void);
+struct hstrtab	*hstrtab_ref(struct hstrtab *);
 
 #define 	 HBUF_PUTSL(output, literal) \
 		 hbuf_put(output, literal, sizeof(literal) - 1)
 
-size_t		 halink_email(size_t *, struct lowdown_buf *, char *, size_t, size_t);
-size_t		 halink_url(size_t *, struct lowdown_buf *, char *, size_t, size_t);
-size_t		 halink_www(size_t *, struct lowdown_buf *, char *, size_t, size_t);
+size_t		 halink_email(size_t *, char *, size_t, size_t);
+size_t		 halink_url(size_t *, char *, size_t, size_t);
+size_t		 halink_www(size_t *, char *, size_t, size_t);
 
 void		 hesc_attr(struct lowdown_buf *, const char *, size_t);
 void		 hesc_href(struct lowdown_buf *, const char *, size_t);
 void		 hesc_html(struct lowdown_buf *, const char *, size_t, int, int, int);
+void		 hesc_latex(struct lowdown_buf *, const char *, size_t);
+void		 hesc_nroff(struct lowdown_buf *, const char *, size_t, int, int, int);
+
+struct term;
+
+size_t		 term_mbswidth(struct term *, const char *, size_t);
 
 char		*rcsdate2str(const char *);
 char		*date2str(const char *);
 char		*rcsauthor2str(const char *);
 
+/*
+ * Static (USDT) tracepoints for perf(1), bpftrace(8), dtrace(1), etc.
+ * They're compiled out unless <sys/sdt.h> was found by configure.
+ * Provider is "lowdown"; probes and their arguments are:
+ *
+ *   doc__start(size)			parse begins on input of size
+ *   doc__done(size, nodes)		parse ends with node count
+ *   node__push(type, id)		parse enters a node
+ *   node__pop(type, id)		parse leaves a node
+ *   render__start(name, id)		renderer "name" starts at node id
+ *   render__done(name, size)		renderer ends with output size
+ *   smarty__start(nodes)		smartypants begins
+ *   smarty__done(nodes)		smartypants ends
+ *   diff__phase__start(phase)		lowdown_diff() phase begins
+ *   diff__phase__done(phase)		lowdown_diff() phase ends
+ *
+ * Types are enum lowdown_rndrt and phases enum diff_phase.
+ */
+#if HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define LOWDOWN_PROBE1(name, a) \
+	DTRACE_PROBE1(lowdown, name, a)
+# define LOWDOWN_PROBE2(name, a, b) \
+	DTRACE_PROBE2(lowdown, name, a, b)
+#else
+# define LOWDOWN_PROBE1(name, a) \
+	do { } while (0)
+# define LOWDOWN_PROBE2(name, a, b) \
+	do { } while (0)
+#endif
+
 #endif /* !EXTERN_H */
@@ -20,7 +20,6 @@
 # include <sys/queue.h>
 #endif
 
-#include <assert.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -46,8 +45,12 @@
  * A link queued for display.
  * This only happens when using footnote or endnote links.
  */
+/*
+ * The link address is copied: the node may not outlive the queue, as
+ * with table rows expanded while rendering.
+ */
 struct link {
-	const struct lowdown_node	*n; /* node needing link */
+	struct lowdown_buf		 link; /* copy of link address */
 	size_t				 id; /* link-%zu */
 	TAILQ_ENTRY(link)		 entries;
 };
@@ -145,42 +148,6 @@ rndr_buf(struct gemini *gemini, struct lowdown_buf *out,
 		gemini->last_blank = 0;
 }
 
-/*
- * Output the unicode entry "val", which must be strictly greater than
- * zero, as a UTF-8 sequence.
- * This does no error checking.
- */
-static void
-rndr_entity(struct lowdown_buf *buf, int32_t val)
-{
-
-	assert(val > 0);
-	if (val < 0x80) {
-		hbuf_putc(buf, val);
-		return;
-	}
-       	if (val < 0x800) {
-		hbuf_putc(buf, 192 + val / 64);
-		hbuf_putc(buf, 128 + val % 64);
-		return;
-	}
-       	if (val - 0xd800u < 0x800) 
-		return;
-       	if (val < 0x10000) {
-		hbuf_putc(buf, 224 + val / 4096);
-		hbuf_putc(buf, 128 + val / 64 % 64);
-		hbuf_putc(buf, 128 + val % 64);
-		return;
-	}
-       	if (val < 0x110000) {
-		hbuf_putc(buf, 240 + val / 262144);
-		hbuf_putc(buf, 128 + val / 4096 % 64);
-		hbuf_putc(buf, 128 + val / 64 % 64);
-		hbuf_putc(buf, 128 + val % 64);
-		return;
-	}
-}
-
 /*
  * Render the key and value, then store the results in our "mq"
  * conditional to it existing.
@@ -230,14 +197,12 @@ rndr_flush_linkq(struct gemini *gemini, struct lowdown_buf *out)
 	while ((l = TAILQ_FIRST(&gemini->linkq)) != NULL) {
 		TAILQ_REMOVE(&gemini->linkq, l, entries);
 		HBUF_PUTSL(out, "=> ");
-		if (l->n->type == LOWDOWN_LINK)
-			hbuf_putb(out, &l->n->rndr_link.link);
-		else if (l->n->type == LOWDOWN_LINK_AUTO)
-			hbuf_putb(out, &l->n->rndr_autolink.link);
-		else if (l->n->type == LOWDOWN_IMAGE)
-			hbuf_putb(out, &l->n->rndr_image.link);
-		hbuf_printf(out, " [Reference: link-%zu]\n", l->id);
+		hbuf_putb(out, &l->link);
+		HBUF_PUTSL(out, " [Reference: link-");
+		hbuf_putu(out, l->id);
+		HBUF_PUTSL(out, "]\n");
 		gemini->last_blank = 1;
+		hbuf_free(&l->link);
 		free(l);
 	}
 }
@@ -247,6 +212,7 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 	struct gemini *p, const struct lowdown_node *n)
 {
 	const struct lowdown_node	*child, *prev;
+	struct lowdown_node		*row;
 	int32_t				 entity;
 	size_t				 i;
 	struct link			*l;
@@ -349,8 +315,9 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		rndr_buf(p, ob, n, p->tmp);
 		break;
 	case LOWDOWN_FOOTNOTE_DEF:
-		hbuf_printf(p->tmp, "[%zu] ", 
-			n->rndr_footnote_def.num);
+		hbuf_putc(p->tmp, '[');
+		hbuf_putu(p->tmp, n->rndr_footnote_def.num);
+		HBUF_PUTSL(p->tmp, "] ");
 		rndr_buf(p, ob, n, p->tmp);
 		p->last_blank = -1;
 		break;
@@ -372,10 +339,10 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		}
 		break;
 	case LOWDOWN_LISTITEM:
-		if (n->rndr_listitem.flags & HLIST_FL_ORDERED)
-			hbuf_printf(p->tmp, "%zu. ", 
-				n->rndr_listitem.num);
-		else
+		if (n->rndr_listitem.flags & HLIST_FL_ORDERED) {
+			hbuf_putu(p->tmp, n->rndr_listitem.num);
+			HBUF_PUTSL(p->tmp, ". ");
+		} else
 			HBUF_PUTSL(p->tmp, "* ");
 		rndr_buf(p, ob, n, p->tmp);
 		p->last_blank = -1;
@@ -393,8 +360,12 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 
 	/* Descend into children. */
 
-	TAILQ_FOREACH(child, &n->children, entries)
-		rndr(ob, mq, p, child);
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		if ((row = table_row_expand(child)) != NULL) {
+			rndr(ob, mq, p, row);
+			lowdown_node_free(row);
+		} else
+			rndr(ob, mq, p, child);
 
 	/* Output non-child or trailing content. */
 
@@ -405,8 +376,9 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		rndr_buf(p, ob, n, p->tmp);
 		break;
 	case LOWDOWN_FOOTNOTE_REF:
-		hbuf_printf(p->tmp, "[%zu]", 
-			n->rndr_footnote_ref.num);
+		hbuf_putc(p->tmp, '[');
+		hbuf_putu(p->tmp, n->rndr_footnote_ref.num);
+		hbuf_putc(p->tmp, ']');
 		rndr_buf(p, ob, n, p->tmp);
 		break;
 	case LOWDOWN_RAW_HTML:
@@ -418,7 +390,7 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 	case LOWDOWN_ENTITY:
 		entity = entity_find_iso(&n->rndr_entity.text);
 		if (entity > 0) {
-			rndr_entity(p->tmp, entity);
+			entity_utf8(p->tmp, entity);
 			rndr_buf(p, ob, n, p->tmp);
 		} else
 			rndr_buf(p, ob, n, &n->rndr_entity.text);
@@ -441,10 +413,17 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		    (p->flags & LOWDOWN_GEMINI_LINK_IN))
 			break;
 		l = xcalloc(1, sizeof(struct link));
-		l->n = n;
+		if (n->type == LOWDOWN_LINK)
+			hbuf_clone(&n->rndr_link.link, &l->link);
+		else if (n->type == LOWDOWN_LINK_AUTO)
+			hbuf_clone(&n->rndr_autolink.link, &l->link);
+		else
+			hbuf_clone(&n->rndr_image.link, &l->link);
 		l->id = ++p->linkqsz;
 		TAILQ_INSERT_TAIL(&p->linkq, l, entries);
-		hbuf_printf(p->tmp, "[Reference: link-%zu]", l->id);
+		HBUF_PUTSL(p->tmp, "[Reference: link-");
+		hbuf_putu(p->tmp, l->id);
+		hbuf_putc(p->tmp, ']');
 		rndr_buf(p, ob, n, p->tmp);
 		break;
 	case LOWDOWN_NORMAL_TEXT:
@@ -536,7 +515,9 @@ lowdown_gemini_rndr(struct lowdown_buf *ob,
 {
 	struct gemini	*p = arg;
 
+	LOWDOWN_PROBE2(render__start, "gemini", n->id);
 	rndr(ob, mq, p, n);
+	LOWDOWN_PROBE2(render__done, "gemini", ob->size);
 }
 
 void *
@@ -570,6 +551,7 @@ lowdown_gemini_free(void *arg)
 
 	while ((l = TAILQ_FIRST(&p->linkq)) != NULL) {
 		TAILQ_REMOVE(&p->linkq, l, entries);
+		hbuf_free(&l->link);
 		free(l);
 	}
 
@@ -24,7 +24,6 @@
 #endif
 
 #include <ctype.h>
-#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,21 +34,64 @@
 #include "extern.h"
 
 /*
- * Queue entry for header names.
- * Keep these so we can make sure that headers have a unique "id" for
- * themselves.
+ * Header identifier already given, kept so that headers (and their
+ * table of contents entries) have a unique "id" for themselves.
+ * See rndr_header_id().
  */
 struct	hentry {
-	char		*str; /* header name (raw) */
-	size_t	 	 count; /* references */
-	TAILQ_ENTRY(hentry) entries;
+	char		*str; /* identifier (escaped) */
+	size_t		 len; /* length of str */
+	uint32_t	 hash; /* hbuf_hash() of str */
+	size_t	 	 count; /* last suffix tried */
+	struct hentry	*next; /* next in hash bin */
+};
+
+/*
+ * Set of header identifiers given, hashed into bins.
+ */
+struct	hids {
+	struct hentry	**bins; /* bins (or NULL if none yet) */
+	size_t		  binsz; /* number of bins (power of two) */
+	size_t		  idsz; /* number of identifiers */
+};
+
+/*
+ * Maximum nesting of a table of contents, one per header level.
+ */
+#define	TOC_MAX	6
+
+/*
+ * Open lists of a table of contents.
+ */
+struct	toc {
+	size_t			 levels[TOC_MAX]; /* level of each */
+	size_t			 open; /* number of open lists */
+};
+
+/*
+ * Size of the escaped-string cache (a power of two).
+ */
+#define	HCACHE_MAX	64
+
+/*
+ * Escaped form of a string interned while parsing (see hbuf_intern()),
+ * which is known by its data pointer.
+ * The entry holds a reference to the string, as nodes may be freed
+ * while rendering (expanded table rows) and their strings' storage
+ * reused for others.
+ */
+struct	hcache {
+	struct lowdown_buf	 key; /* interned string (or empty) */
+	int			 attr; /* hesc_attr() (else hesc_href()) */
+	struct lowdown_buf	*val; /* escaped string */
 };
 
 /*
  * Our internal state object.
  */
 struct 	html {
-	TAILQ_HEAD(, hentry) 	 headers_used;
+	struct hids		 headers_used; /* header ids given */
+	struct hcache		 cache[HCACHE_MAX]; /* by key */
 	size_t			 base_header_level; /* header offset */
 	unsigned int 		 flags; /* "oflags" in lowdown_opts */
 };
@@ -84,9 +126,62 @@ escape_literal(struct lowdown_buf *ob, const char *source,
 		(st->flags & LOWDOWN_HTML_NUM_ENT));
 }
 
+/*
+ * Forget the escaped strings of the last tree rendered, releasing
+ * their keys.
+ */
+static void
+escape_cache_reset(struct html *st)
+{
+	size_t	 i;
+
+	for (i = 0; i < HCACHE_MAX; i++) {
+		hbuf_free(&st->cache[i].key);
+		memset(&st->cache[i].key, 0, sizeof(struct lowdown_buf));
+	}
+}
+
+/*
+ * Escape "buf" as a URL (or attribute, if "attr"), copying the escaped
+ * form from the cache if it's an interned string already seen.
+ * Other strings are escaped as they are: hashing them to look them up
+ * would cost as much as escaping them.
+ */
+static void
+escape_cached(struct lowdown_buf *ob, const struct lowdown_buf *buf,
+	int attr, struct html *st)
+{
+	struct hcache	*c;
+
+	if (buf->asize != HBUF_SHARED) {
+		if (attr)
+			hesc_attr(ob, buf->data, buf->size);
+		else
+			hesc_href(ob, buf->data, buf->size);
+		return;
+	}
+
+	c = &st->cache[(((uintptr_t)buf->data >> 4) ^ attr) &
+		(HCACHE_MAX - 1)];
+	if (c->key.data != buf->data || c->attr != attr) {
+		if (c->val == NULL)
+			c->val = hbuf_new(64);
+		else
+			hbuf_truncate(c->val);
+		if (attr)
+			hesc_attr(c->val, buf->data, buf->size);
+		else
+			hesc_href(c->val, buf->data, buf->size);
+		hbuf_free(&c->key);
+		hbuf_clone(buf, &c->key);
+		c->attr = attr;
+	}
+	hbuf_putb(ob, c->val);
+}
+
 static void
 rndr_autolink(struct lowdown_buf *ob, const struct lowdown_buf *link,
-	enum halink_type type, const struct html *st)
+	enum halink_type type, struct html *st)
 {
 
 	if (link->size == 0)
@@ -95,7 +190,7 @@ rndr_autolink(struct lowdown_buf *ob, const struct lowdown_buf *link,
 	HBUF_PUTSL(ob, "<a href=\"");
 	if (type == HALINK_EMAIL)
 		HBUF_PUTSL(ob, "mailto:");
-	hesc_href(ob, link->data, link->size);
+	escape_cached(ob, link, 0, st);
 	HBUF_PUTSL(ob, "\">");
 
 	/*
@@ -112,37 +207,78 @@ rndr_autolink(struct lowdown_buf *ob, const struct lowdown_buf *link,
 	HBUF_PUTSL(ob, "</a>");
 }
 
+/*
+ * The input lines and bytes of block elements parsed with
+ * LOWDOWN_SRCPOS, as attributes.
+ */
+static void
+rndr_srcpos(struct lowdown_buf *ob, const struct lowdown_node *n)
+{
+	struct lowdown_pos	 pos;
+
+	if (!lowdown_node_pos(n, &pos))
+		return;
+	HBUF_PUTSL(ob, " data-lines=\"");
+	hbuf_putu(ob, pos.line);
+	hbuf_putc(ob, '-');
+	hbuf_putu(ob, pos.line + pos.lines);
+	HBUF_PUTSL(ob, "\" data-bytes=\"");
+	hbuf_putu(ob, pos.off);
+	hbuf_putc(ob, '-');
+	hbuf_putu(ob, pos.off + pos.len);
+	hbuf_putc(ob, '"');
+}
+
+/*
+ * Newline between or within block elements, which is left out with
+ * LOWDOWN_HTML_COMPACT.
+ */
+static void
+rndr_nl(struct lowdown_buf *ob, const struct html *st)
+{
+
+	if (!(st->flags & LOWDOWN_HTML_COMPACT))
+		hbuf_putc(ob, '\n');
+}
+
 static void
 rndr_blockcode(struct lowdown_buf *ob, const struct lowdown_buf *text,
-	const struct lowdown_buf *lang, const struct html *st)
+	const struct lowdown_buf *lang, const struct lowdown_node *n,
+	const struct html *st)
 {
 	if (ob->size) 
-		hbuf_putc(ob, '\n');
+		rndr_nl(ob, st);
 
+	HBUF_PUTSL(ob, "<pre");
+	rndr_srcpos(ob, n);
 	if (lang->size) {
-		HBUF_PUTSL(ob, "<pre><code class=\"language-");
+		HBUF_PUTSL(ob, "><code class=\"language-");
 		hesc_href(ob, lang->data, lang->size);
 		HBUF_PUTSL(ob, "\">");
 	} else
-		HBUF_PUTSL(ob, "<pre><code>");
+		HBUF_PUTSL(ob, "><code>");
 
 	escape_literal(ob, text->data, text->size, st);
-	HBUF_PUTSL(ob, "</code></pre>\n");
+	HBUF_PUTSL(ob, "</code></pre>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_definition_data(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct html *st)
 {
 
-	HBUF_PUTSL(ob, "<dd>\n");
+	HBUF_PUTSL(ob, "<dd>");
+	rndr_nl(ob, st);
 	hbuf_putb(ob, content);
-	HBUF_PUTSL(ob, "\n</dd>\n");
+	rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "</dd>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_definition_title(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct html *st)
 {
 	size_t	 sz;
 
@@ -152,29 +288,40 @@ rndr_definition_title(struct lowdown_buf *ob,
 			sz--;
 		hbuf_put(ob, content->data, sz);
 	}
-	HBUF_PUTSL(ob, "</dt>\n");
+	HBUF_PUTSL(ob, "</dt>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_definition(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct lowdown_node *n,
+	const struct html *st)
 {
 	if (ob->size)
-		hbuf_putc(ob, '\n');
-	HBUF_PUTSL(ob, "<dl>\n");
+		rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<dl");
+	rndr_srcpos(ob, n);
+	HBUF_PUTSL(ob, ">");
+	rndr_nl(ob, st);
 	hbuf_putb(ob, content);
-	HBUF_PUTSL(ob, "</dl>\n");
+	HBUF_PUTSL(ob, "</dl>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_blockquote(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct lowdown_node *n,
+	const struct html *st)
 {
 	if (ob->size)
-		hbuf_putc(ob, '\n');
-	HBUF_PUTSL(ob, "<blockquote>\n");
+		rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<blockquote");
+	rndr_srcpos(ob, n);
+	HBUF_PUTSL(ob, ">");
+	rndr_nl(ob, st);
 	hbuf_put(ob, content->data, content->size);
-	HBUF_PUTSL(ob, "</blockquote>\n");
+	HBUF_PUTSL(ob, "</blockquote>");
+	rndr_nl(ob, st);
 }
 
 static void
@@ -234,61 +381,130 @@ rndr_linebreak(struct lowdown_buf *ob)
 	HBUF_PUTSL(ob, "<br/>\n");
 }
 
+/*
+ * Look up identifier "id" of "len" bytes and hash "hash".
+ * Returns NULL if it hasn't been given.
+ */
+static struct hentry *
+hids_find(const struct hids *ids, const char *id, size_t len,
+	uint32_t hash)
+{
+	struct hentry	*e;
+
+	if (ids->bins == NULL)
+		return NULL;
+	for (e = ids->bins[hash & (ids->binsz - 1)]; e != NULL; e = e->next)
+		if (e->hash == hash && e->len == len &&
+		    memcmp(e->str, id, len) == 0)
+			return e;
+	return NULL;
+}
+
+/*
+ * Add identifier "id" of "len" bytes and hash "hash", which must not
+ * already have been given.
+ */
+static struct hentry *
+hids_add(struct hids *ids, const char *id, size_t len, uint32_t hash)
+{
+	struct hentry	**bins, *e, *next;
+	size_t		  i, binsz;
+
+	if (ids->idsz >= ids->binsz) {
+		binsz = ids->binsz == 0 ? 64 : ids->binsz * 2;
+		bins = xcalloc(binsz, sizeof(struct hentry *));
+		for (i = 0; i < ids->binsz; i++)
+			for (e = ids->bins[i]; e != NULL; e = next) {
+				next = e->next;
+				e->next = bins[e->hash & (binsz - 1)];
+				bins[e->hash & (binsz - 1)] = e;
+			}
+		free(ids->bins);
+		ids->bins = bins;
+		ids->binsz = binsz;
+	}
+
+	e = xcalloc(1, sizeof(struct hentry));
+	e->str = xstrndup(id, len);
+	e->len = len;
+	e->hash = hash;
+	e->count = 1;
+	e->next = ids->bins[hash & (ids->binsz - 1)];
+	ids->bins[hash & (ids->binsz - 1)] = e;
+	ids->idsz++;
+	return e;
+}
+
+/*
+ * Forget all identifiers given.
+ */
+static void
+hids_clear(struct hids *ids)
+{
+	struct hentry	*e, *next;
+	size_t		 i;
+
+	for (i = 0; i < ids->binsz; i++)
+		for (e = ids->bins[i]; e != NULL; e = next) {
+			next = e->next;
+			free(e->str);
+			free(e);
+		}
+	free(ids->bins);
+	memset(ids, 0, sizeof(struct hids));
+}
+
 /*
  * Given the header with non-empty content "header", fill "ob" with the
  * identifier used for the header.
- * This will reference-count the header so we don't have duplicates.
+ * This is the escaped content or, if that's already been given, the
+ * same suffixed with the first "-2", "-3", etc. not given either (so
+ * "foo", "foo-2", "foo" give "foo", "foo-2", "foo-3").
+ * Identifiers are recorded so that all are unique.
  */
 static void
 rndr_header_id(struct lowdown_buf *ob,
 	const struct lowdown_buf *header, struct html *st)
 {
 	struct hentry	*hentry;
+	size_t		 start = ob->size, len;
+	uint32_t	 hash;
 
-	/* 
-	 * See if the header was previously already defind. 
-	 * Note that in HTML5, the identifier is case sensitive.
-	 */
-
-	TAILQ_FOREACH(hentry, &st->headers_used, entries) {
-		if (strlen(hentry->str) != header->size)
-			continue;
-		if (strncmp(hentry->str, 
-		    header->data, header->size) == 0)
-			break;
-	}
-
-	/* Convert to escaped values. */
+	/* Note that in HTML5, the identifier is case sensitive. */
 
 	hesc_href(ob, header->data, header->size);
+	len = ob->size - start;
+	hash = hbuf_hash(ob->data + start, len);
+
+	hentry = hids_find(&st->headers_used, ob->data + start, len, hash);
+	if (hentry == NULL) {
+		hids_add(&st->headers_used, ob->data + start, len, hash);
+		return;
+	}
 
 	/*
-	 * If we're non-unique, then append a "count" value.
-	 * XXX: if we have a header named "foo-2", then two headers
-	 * named "foo", we'll inadvertently have a collision.
-	 * This is a bit much to keep track of, though...
+	 * Try the suffixes after the last one given for this
+	 * identifier until one is new.
 	 */
 
-	if (hentry != NULL) {
-		hentry->count++;
-		hbuf_printf(ob, "-%zu", hentry->count);
-		return;
-	} 
-
-	/* Create new header entry. */
+	do {
+		ob->size = start + len;
+		hbuf_putc(ob, '-');
+		hbuf_putu(ob, ++hentry->count);
+		hash = hbuf_hash(ob->data + start, ob->size - start);
+	} while (hids_find(&st->headers_used,
+	    ob->data + start, ob->size - start, hash) != NULL);
 
-	hentry = xcalloc(1, sizeof(struct hentry));
-	hentry->count = 1;
-	hentry->str = xstrndup(header->data, header->size);
-	TAILQ_INSERT_TAIL(&st->headers_used, hentry, entries);
+	hids_add(&st->headers_used,
+		ob->data + start, ob->size - start, hash);
 }
 
 static void
 rndr_header(struct lowdown_buf *ob,
 	const struct lowdown_buf *content,
-	const struct rndr_header *dat, struct html *st)
+	const struct lowdown_node *n, struct html *st)
 {
-	size_t	level = dat->level + st->base_header_level;
+	size_t	level = n->rndr_header.level + st->base_header_level;
 
 	/* HTML doesn't allow greater than <h6>. */
 
@@ -296,31 +512,37 @@ rndr_header(struct lowdown_buf *ob,
 		level = 6;
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
+		rndr_nl(ob, st);
 
+	HBUF_PUTSL(ob, "<h");
+	hbuf_putu(ob, level);
+	rndr_srcpos(ob, n);
 	if (content->size && (st->flags & LOWDOWN_HTML_HEAD_IDS)) {
-		hbuf_printf(ob, "<h%zu id=\"", level);
+		HBUF_PUTSL(ob, " id=\"");
 		rndr_header_id(ob, content, st);
 		HBUF_PUTSL(ob, "\">");
 	} else
-		hbuf_printf(ob, "<h%zu>", level);
+		HBUF_PUTSL(ob, ">");
 
 	hbuf_putb(ob, content);
-	hbuf_printf(ob, "</h%zu>\n", level);
+	HBUF_PUTSL(ob, "</h");
+	hbuf_putu(ob, level);
+	hbuf_putc(ob, '>');
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_link(struct lowdown_buf *ob,
 	const struct lowdown_buf *content,
 	const struct lowdown_buf *link, 
-	const struct lowdown_buf *title, const struct html *st)
+	const struct lowdown_buf *title, struct html *st)
 {
 
 	HBUF_PUTSL(ob, "<a href=\"");
-	hesc_href(ob, link->data, link->size);
+	escape_cached(ob, link, 0, st);
 	if (title->size) {
 		HBUF_PUTSL(ob, "\" title=\"");
-		hesc_attr(ob, title->data, title->size);
+		escape_cached(ob, title, 1, st);
 	}
 	HBUF_PUTSL(ob, "\">");
 	hbuf_putb(ob, content);
@@ -330,31 +552,38 @@ rndr_link(struct lowdown_buf *ob,
 static void
 rndr_list(struct lowdown_buf *ob,
 	const struct lowdown_buf *content,
-	const struct rndr_list *p)
+	const struct lowdown_node *n, const struct html *st)
 {
+	const struct rndr_list	*p = &n->rndr_list;
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
+		rndr_nl(ob, st);
 	if ((p->flags & HLIST_FL_ORDERED)) {
-		if (p->start[0] != '\0') 
-			hbuf_printf(ob, "<ol start=\"%s\">\n", p->start);
-		else
-			HBUF_PUTSL(ob, "<ol>\n");
+		HBUF_PUTSL(ob, "<ol");
+		if (p->start[0] != '\0') {
+			HBUF_PUTSL(ob, " start=\"");
+			hbuf_puts(ob, p->start);
+			hbuf_putc(ob, '"');
+		}
 	} else
-		HBUF_PUTSL(ob, "<ul>\n");
+		HBUF_PUTSL(ob, "<ul");
+	rndr_srcpos(ob, n);
+	HBUF_PUTSL(ob, ">");
+	rndr_nl(ob, st);
 
 	hbuf_putb(ob, content);
 
 	if ((p->flags & HLIST_FL_ORDERED))
-		HBUF_PUTSL(ob, "</ol>\n");
+		HBUF_PUTSL(ob, "</ol>");
 	else
-		HBUF_PUTSL(ob, "</ul>\n");
+		HBUF_PUTSL(ob, "</ul>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_listitem(struct lowdown_buf *ob,
 	const struct lowdown_buf *content,
-	const struct lowdown_node *n)
+	const struct lowdown_node *n, const struct html *st)
 {
 	size_t	 size;
 	int	 blk = 0;
@@ -381,16 +610,20 @@ rndr_listitem(struct lowdown_buf *ob,
 		      hbuf_strprefix(content, "<div") ||
 		      hbuf_strprefix(content, "<table") ||
 		      hbuf_strprefix(content, "<blockquote") ||
-		      hbuf_strprefix(content, "<pre>") ||
+		      hbuf_strprefix(content, "<pre") ||
 		      hbuf_strprefix(content, "<h") ||
-		      hbuf_strprefix(content, "<p>")))
+		      hbuf_strprefix(content, "<p>") ||
+		      hbuf_strprefix(content, "<p ")))
 			blk = 1;
 	}
 
 	/* Only emit <li> if we're not a <dl> list. */
 
-	if (!(n->rndr_listitem.flags & HLIST_FL_DEF))
-		HBUF_PUTSL(ob, "<li>");
+	if (!(n->rndr_listitem.flags & HLIST_FL_DEF)) {
+		HBUF_PUTSL(ob, "<li");
+		rndr_srcpos(ob, n);
+		HBUF_PUTSL(ob, ">");
+	}
 	if (blk)
 		HBUF_PUTSL(ob, "<p>");
 
@@ -404,18 +637,21 @@ rndr_listitem(struct lowdown_buf *ob,
 
 	if (blk)
 		HBUF_PUTSL(ob, "</p>");
-	if (!(n->rndr_listitem.flags & HLIST_FL_DEF))
-		HBUF_PUTSL(ob, "</li>\n");
+	if (!(n->rndr_listitem.flags & HLIST_FL_DEF)) {
+		HBUF_PUTSL(ob, "</li>");
+		rndr_nl(ob, st);
+	}
 }
 
 static void
 rndr_paragraph(struct lowdown_buf *ob,
-	const struct lowdown_buf *content, struct html *state)
+	const struct lowdown_buf *content,
+	const struct lowdown_node *n, struct html *state)
 {
 	size_t	i = 0, org;
 
 	if (ob->size) 
-		hbuf_putc(ob, '\n');
+		rndr_nl(ob, state);
 
 	if (content->size == 0)
 		return;
@@ -427,7 +663,9 @@ rndr_paragraph(struct lowdown_buf *ob,
 	if (i == content->size)
 		return;
 
-	HBUF_PUTSL(ob, "<p>");
+	HBUF_PUTSL(ob, "<p");
+	rndr_srcpos(ob, n);
+	HBUF_PUTSL(ob, ">");
 	if (state->flags & LOWDOWN_HTML_HARD_WRAP) {
 		while (i < content->size) {
 			org = i;
@@ -450,7 +688,8 @@ rndr_paragraph(struct lowdown_buf *ob,
 	} else
 		hbuf_put(ob, content->data + i, content->size - i);
 
-	HBUF_PUTSL(ob, "</p>\n");
+	HBUF_PUTSL(ob, "</p>");
+	rndr_nl(ob, state);
 }
 
 static void
@@ -482,10 +721,10 @@ rndr_raw_block(struct lowdown_buf *ob,
 		return;
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
+		rndr_nl(ob, st);
 
 	hbuf_put(ob, text->data + org, sz - org);
-	hbuf_putc(ob, '\n');
+	rndr_nl(ob, st);
 }
 
 static void
@@ -499,18 +738,22 @@ rndr_triple_emphasis(struct lowdown_buf *ob,
 }
 
 static void
-rndr_hrule(struct lowdown_buf *ob)
+rndr_hrule(struct lowdown_buf *ob, const struct lowdown_node *n,
+	const struct html *st)
 {
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
-	hbuf_puts(ob, "<hr/>\n");
+		rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<hr");
+	rndr_srcpos(ob, n);
+	HBUF_PUTSL(ob, "/>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_image(struct lowdown_buf *ob,
 	const struct rndr_image *p, 
-	const struct html *st)
+	struct html *st)
 {
 	char		 dimbuf[32];
 	unsigned int	 x, y;
@@ -531,7 +774,7 @@ rndr_image(struct lowdown_buf *ob,
 	/* Require an "alt", even if blank. */
 
 	HBUF_PUTSL(ob, "<img src=\"");
-	hesc_href(ob, p->link.data, p->link.size);
+	escape_cached(ob, &p->link, 0, st);
 	HBUF_PUTSL(ob, "\" alt=\"");
 	hesc_attr(ob, p->alt.data, p->alt.size);
 	HBUF_PUTSL(ob, "\"");
@@ -552,9 +795,14 @@ rndr_image(struct lowdown_buf *ob,
 		}
 		HBUF_PUTSL(ob, "\"");
 	} else if (p->dims.size && rc > 0) {
-		hbuf_printf(ob, " width=\"%u\"", x);
-		if (rc > 1)
-			hbuf_printf(ob, " height=\"%u\"", y);
+		HBUF_PUTSL(ob, " width=\"");
+		hbuf_putu(ob, x);
+		hbuf_putc(ob, '"');
+		if (rc > 1) {
+			HBUF_PUTSL(ob, " height=\"");
+			hbuf_putu(ob, y);
+			hbuf_putc(ob, '"');
+		}
 	}
 
 	if (p->title.size) {
@@ -581,55 +829,70 @@ rndr_raw_html(struct lowdown_buf *ob,
 
 static void
 rndr_table(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct lowdown_node *n,
+	const struct html *st)
 {
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
-	HBUF_PUTSL(ob, "<table>\n");
+		rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<table");
+	rndr_srcpos(ob, n);
+	HBUF_PUTSL(ob, ">");
+	rndr_nl(ob, st);
 	hbuf_putb(ob, content);
-	HBUF_PUTSL(ob, "</table>\n");
+	HBUF_PUTSL(ob, "</table>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_table_header(struct lowdown_buf *ob,
 	const struct lowdown_buf *content, 
-	const enum htbl_flags *fl, size_t columns)
+	const enum htbl_flags *fl, size_t columns, const struct html *st)
 {
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
-	HBUF_PUTSL(ob, "<thead>\n");
+		rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<thead>");
+	rndr_nl(ob, st);
 	hbuf_putb(ob, content);
-	HBUF_PUTSL(ob, "</thead>\n");
+	HBUF_PUTSL(ob, "</thead>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_table_body(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct html *st)
 {
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
-	HBUF_PUTSL(ob, "<tbody>\n");
+		rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<tbody>");
+	rndr_nl(ob, st);
 	hbuf_putb(ob, content);
-	HBUF_PUTSL(ob, "</tbody>\n");
+	HBUF_PUTSL(ob, "</tbody>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_tablerow(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct lowdown_node *n,
+	const struct html *st)
 {
 
-	HBUF_PUTSL(ob, "<tr>\n");
+	HBUF_PUTSL(ob, "<tr");
+	rndr_srcpos(ob, n);
+	HBUF_PUTSL(ob, ">");
+	rndr_nl(ob, st);
 	hbuf_putb(ob, content);
-	HBUF_PUTSL(ob, "</tr>\n");
+	HBUF_PUTSL(ob, "</tr>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_tablecell(struct lowdown_buf *ob,
 	const struct lowdown_buf *content,
-	enum htbl_flags flags, size_t col, size_t columns)
+	enum htbl_flags flags, size_t col, size_t columns,
+	const struct html *st)
 {
 
 	if ((flags & HTBL_FL_HEADER))
@@ -654,9 +917,10 @@ rndr_tablecell(struct lowdown_buf *ob,
 	hbuf_putb(ob, content);
 
 	if ((flags & HTBL_FL_HEADER))
-		HBUF_PUTSL(ob, "</th>\n");
+		HBUF_PUTSL(ob, "</th>");
 	else
-		HBUF_PUTSL(ob, "</td>\n");
+		HBUF_PUTSL(ob, "</td>");
+	rndr_nl(ob, st);
 }
 
 static void
@@ -680,21 +944,29 @@ rndr_normal_text(struct lowdown_buf *ob,
 
 static void
 rndr_footnotes(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
+	const struct lowdown_buf *content, const struct html *st)
 {
 
 	if (ob->size)
-		hbuf_putc(ob, '\n');
-	HBUF_PUTSL(ob, "<div class=\"footnotes\">\n");
-	hbuf_puts(ob, "<hr/>\n");
-	HBUF_PUTSL(ob, "<ol>\n");
+		rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<div class=\"footnotes\">");
+	rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<hr/>");
+	rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<ol>");
+	rndr_nl(ob, st);
 	hbuf_putb(ob, content);
-	HBUF_PUTSL(ob, "\n</ol>\n</div>\n");
+	rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "</ol>");
+	rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "</div>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_footnote_def(struct lowdown_buf *ob,
-	const struct lowdown_buf *content, size_t num)
+	const struct lowdown_buf *content, size_t num,
+	const struct html *st)
 {
 	size_t	i = 0;
 	int	pfound = 0;
@@ -716,28 +988,36 @@ rndr_footnote_def(struct lowdown_buf *ob,
 		break;
 	}
 
-	hbuf_printf(ob, "\n<li id=\"fn%zu\">\n", num);
+	rndr_nl(ob, st);
+	HBUF_PUTSL(ob, "<li id=\"fn");
+	hbuf_putu(ob, num);
+	HBUF_PUTSL(ob, "\">");
+	rndr_nl(ob, st);
 
 	if (pfound) {
 		hbuf_put(ob, content->data, i);
-		hbuf_printf(ob, "&#160;"
-			"<a href=\"#fnref%zu\" rev=\"footnote\">"
-			"&#8617;</a>", num);
+		HBUF_PUTSL(ob, "&#160;<a href=\"#fnref");
+		hbuf_putu(ob, num);
+		HBUF_PUTSL(ob, "\" rev=\"footnote\">&#8617;</a>");
 		hbuf_put(ob, content->data + i, content->size - i);
 	} else 
 		hbuf_putb(ob, content);
 
-	HBUF_PUTSL(ob, "</li>\n");
+	HBUF_PUTSL(ob, "</li>");
+	rndr_nl(ob, st);
 }
 
 static void
 rndr_footnote_ref(struct lowdown_buf *ob, size_t num)
 {
 
-	hbuf_printf(ob, 
-		"<sup id=\"fnref%zu\">"
-		"<a href=\"#fn%zu\" rel=\"footnote\">"
-		"%zu</a></sup>", num, num, num);
+	HBUF_PUTSL(ob, "<sup id=\"fnref");
+	hbuf_putu(ob, num);
+	HBUF_PUTSL(ob, "\"><a href=\"#fn");
+	hbuf_putu(ob, num);
+	HBUF_PUTSL(ob, "\" rel=\"footnote\">");
+	hbuf_putu(ob, num);
+	HBUF_PUTSL(ob, "</a></sup>");
 }
 
 static void
@@ -928,14 +1208,19 @@ rndr(struct lowdown_buf *ob,
 	const struct lowdown_node *n)
 {
 	const struct lowdown_node	*child;
+	struct lowdown_node		*row;
 	struct lowdown_buf		*tmp;
 	int32_t				 ent;
 	struct html			*st = ref;
 
 	tmp = hbuf_new(64);
 
-	TAILQ_FOREACH(child, &n->children, entries)
-		rndr(tmp, mq, st, child);
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		if ((row = table_row_expand(child)) != NULL) {
+			rndr(tmp, mq, st, row);
+			lowdown_node_free(row);
+		} else
+			rndr(tmp, mq, st, child);
 
 	/*
 	 * These elements can be put in either a block or an inline
@@ -954,19 +1239,19 @@ rndr(struct lowdown_buf *ob,
 	case LOWDOWN_BLOCKCODE:
 		rndr_blockcode(ob, 
 			&n->rndr_blockcode.text, 
-			&n->rndr_blockcode.lang, st);
+			&n->rndr_blockcode.lang, n, st);
 		break;
 	case LOWDOWN_BLOCKQUOTE:
-		rndr_blockquote(ob, tmp);
+		rndr_blockquote(ob, tmp, n, st);
 		break;
 	case LOWDOWN_DEFINITION:
-		rndr_definition(ob, tmp);
+		rndr_definition(ob, tmp, n, st);
 		break;
 	case LOWDOWN_DEFINITION_TITLE:
-		rndr_definition_title(ob, tmp);
+		rndr_definition_title(ob, tmp, st);
 		break;
 	case LOWDOWN_DEFINITION_DATA:
-		rndr_definition_data(ob, tmp);
+		rndr_definition_data(ob, tmp, st);
 		break;
 	case LOWDOWN_DOC_HEADER:
 		rndr_doc_header(ob, tmp, mq, st);
@@ -978,46 +1263,46 @@ rndr(struct lowdown_buf *ob,
 		rndr_doc_footer(ob, st);
 		break;
 	case LOWDOWN_HEADER:
-		rndr_header(ob, tmp, &n->rndr_header, st);
+		rndr_header(ob, tmp, n, st);
 		break;
 	case LOWDOWN_HRULE:
-		rndr_hrule(ob);
+		rndr_hrule(ob, n, st);
 		break;
 	case LOWDOWN_LIST:
-		rndr_list(ob, tmp, &n->rndr_list);
+		rndr_list(ob, tmp, n, st);
 		break;
 	case LOWDOWN_LISTITEM:
-		rndr_listitem(ob, tmp, n);
+		rndr_listitem(ob, tmp, n, st);
 		break;
 	case LOWDOWN_PARAGRAPH:
-		rndr_paragraph(ob, tmp, st);
+		rndr_paragraph(ob, tmp, n, st);
 		break;
 	case LOWDOWN_TABLE_BLOCK:
-		rndr_table(ob, tmp);
+		rndr_table(ob, tmp, n, st);
 		break;
 	case LOWDOWN_TABLE_HEADER:
 		rndr_table_header(ob, tmp, 
 			n->rndr_table_header.flags,
-			n->rndr_table_header.columns);
+			n->rndr_table_header.columns, st);
 		break;
 	case LOWDOWN_TABLE_BODY:
-		rndr_table_body(ob, tmp);
+		rndr_table_body(ob, tmp, st);
 		break;
 	case LOWDOWN_TABLE_ROW:
-		rndr_tablerow(ob, tmp);
+		rndr_tablerow(ob, tmp, n, st);
 		break;
 	case LOWDOWN_TABLE_CELL:
 		rndr_tablecell(ob, tmp, 
 			n->rndr_table_cell.flags, 
 			n->rndr_table_cell.col,
-			n->rndr_table_cell.columns);
+			n->rndr_table_cell.columns, st);
 		break;
 	case LOWDOWN_FOOTNOTES_BLOCK:
-		rndr_footnotes(ob, tmp);
+		rndr_footnotes(ob, tmp, st);
 		break;
 	case LOWDOWN_FOOTNOTE_DEF:
 		rndr_footnote_def(ob, tmp, 
-			n->rndr_footnote_def.num);
+			n->rndr_footnote_def.num, st);
 		break;
 	case LOWDOWN_BLOCKHTML:
 		rndr_raw_block(ob, 
@@ -1091,9 +1376,11 @@ rndr(struct lowdown_buf *ob,
 		 */
 
 		ent = entity_find_iso(&n->rndr_entity.text);
-		if (ent > 0)
-			hbuf_printf(ob, "&#%" PRId32 ";", ent);
-		else
+		if (ent > 0) {
+			HBUF_PUTSL(ob, "&#");
+			hbuf_putu(ob, ent);
+			hbuf_putc(ob, ';');
+		} else
 			hbuf_putb(ob, &n->rndr_entity.text);
 		break;
 	default:
@@ -1125,7 +1412,10 @@ lowdown_html_rndr(struct lowdown_buf *ob,
 	}
 
 	st->base_header_level = 1;
+	html_reset(st);
+	LOWDOWN_PROBE2(render__start, "html", n->id);
 	rndr(ob, mq, st, n);
+	LOWDOWN_PROBE2(render__done, "html", ob->size);
 
 	/* Release temporary metaq. */
 
@@ -1133,6 +1423,148 @@ lowdown_html_rndr(struct lowdown_buf *ob,
 		lowdown_metaq_free(mq);
 }
 
+/*
+ * Add header "n" with non-empty inner HTML "content" to the table of
+ * contents, opening and closing nested lists as the level changes.
+ * Each entry is left open for nested lists.
+ */
+static void
+rndr_toc_header(struct lowdown_buf *ob, struct toc *toc,
+	const struct lowdown_buf *content,
+	const struct lowdown_node *n, struct html *st)
+{
+	size_t	 level = n->rndr_header.level;
+
+	if (level >= TOC_MAX)
+		level = TOC_MAX - 1;
+
+	if (toc->open == 0) {
+		HBUF_PUTSL(ob, "<ul>\n");
+		toc->levels[toc->open++] = level;
+	} else if (level > toc->levels[toc->open - 1]) {
+		HBUF_PUTSL(ob, "\n<ul>\n");
+		toc->levels[toc->open++] = level;
+	} else {
+		HBUF_PUTSL(ob, "</li>\n");
+		while (toc->open > 1 && 
+		       toc->levels[toc->open - 2] >= level) {
+			HBUF_PUTSL(ob, "</ul>\n</li>\n");
+			toc->open--;
+		}
+		if (level < toc->levels[toc->open - 1])
+			toc->levels[toc->open - 1] = level;
+	}
+
+	HBUF_PUTSL(ob, "<li><a href=\"#");
+	rndr_header_id(ob, content, st);
+	HBUF_PUTSL(ob, "\">");
+	hbuf_putb(ob, content);
+	HBUF_PUTSL(ob, "</a>");
+}
+
+/*
+ * Walk the tree for headers, rendering their content as rndr() would to
+ * get the same identifiers.
+ * Don't descend into nodes with only inline content: with LOWDOWN_LAZY,
+ * these are never parsed.
+ */
+static void
+rndr_toc(struct lowdown_buf *ob, struct lowdown_metaq *mq,
+	struct toc *toc, const struct lowdown_node *n, struct html *st)
+{
+	const struct lowdown_node	*child;
+	struct lowdown_buf		*tmp;
+
+	switch (n->type) {
+	case LOWDOWN_HEADER:
+		tmp = hbuf_new(64);
+		TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+			rndr(tmp, mq, st, child);
+		if (tmp->size)
+			rndr_toc_header(ob, toc, tmp, n, st);
+		hbuf_free(tmp);
+		return;
+	case LOWDOWN_DEFINITION_TITLE:
+	case LOWDOWN_DOC_HEADER:
+	case LOWDOWN_PARAGRAPH:
+	case LOWDOWN_TABLE_BLOCK:
+		return;
+	default:
+		break;
+	}
+
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		rndr_toc(ob, mq, toc, child, st);
+}
+
+void
+lowdown_html_toc(struct lowdown_buf *ob, void *arg,
+	const struct lowdown_node *n)
+{
+	struct html		*st = arg;
+	struct lowdown_metaq	 metaq;
+	struct toc		 toc;
+
+	memset(&toc, 0, sizeof(struct toc));
+	TAILQ_INIT(&metaq);
+
+	st->base_header_level = 1;
+	html_reset(st);
+	LOWDOWN_PROBE2(render__start, "toc", n->id);
+	rndr_toc(ob, &metaq, &toc, n, st);
+	if (toc.open) {
+		HBUF_PUTSL(ob, "</li>\n");
+		for ( ; toc.open > 1; toc.open--)
+			HBUF_PUTSL(ob, "</ul>\n</li>\n");
+		HBUF_PUTSL(ob, "</ul>\n");
+	}
+	LOWDOWN_PROBE2(render__done, "toc", ob->size);
+
+	lowdown_metaq_free(&metaq);
+}
+
+/*
+ * Forget the header identifiers given and escaped strings cached by
+ * "arg" when rendering any earlier tree.
+ * This starts lowdown_html_rndr() and lowdown_html_toc(), and must
+ * start any sequence of html_header_id() calls for a new tree.
+ */
+void
+html_reset(void *arg)
+{
+	struct html	*st = arg;
+
+	hids_clear(&st->headers_used);
+	escape_cache_reset(st);
+}
+
+/*
+ * Fill "ob" with the identifier that lowdown_html_rndr() would give
+ * header "n", rendering its content the same way.
+ * Nothing is written if the content is empty, as the header has no
+ * identifier at all.
+ * Identifiers are recorded by "arg" since the last html_reset(), so
+ * each header must be passed exactly once and in document order.
+ */
+void
+html_header_id(struct lowdown_buf *ob, void *arg,
+	const struct lowdown_node *n)
+{
+	struct html			*st = arg;
+	const struct lowdown_node	*child;
+	struct lowdown_buf		*tmp;
+	struct lowdown_metaq		 metaq;
+
+	TAILQ_INIT(&metaq);
+	tmp = hbuf_new(64);
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		rndr(tmp, &metaq, st, child);
+	if (tmp->size)
+		rndr_header_id(ob, tmp, st);
+	hbuf_free(tmp);
+	lowdown_metaq_free(&metaq);
+}
+
 void *
 lowdown_html_new(const struct lowdown_opts *opts)
 {
@@ -1140,7 +1572,6 @@ lowdown_html_new(const struct lowdown_opts *opts)
 
 	st = xcalloc(1, sizeof(struct html));
 
-	TAILQ_INIT(&st->headers_used);
 	st->flags = NULL == opts ? 0 : opts->oflags;
 	return st;
 }
@@ -1149,13 +1580,13 @@ void
 lowdown_html_free(void *arg)
 {
 	struct html	*st = arg;
-	struct hentry	*hentry;
+	size_t		 i;
 
-	while (NULL != (hentry = TAILQ_FIRST(&st->headers_used))) {
-		TAILQ_REMOVE(&st->headers_used, hentry, entries);
-		free(hentry->str);
-		free(hentry);
-	}
+	hids_clear(&st->headers_used);
+	escape_cache_reset(st);
+
+	for (i = 0; i < HCACHE_MAX; i++)
+		hbuf_free(st->cache[i].val);
 
 	free(st);
 }
@@ -36,8 +36,11 @@ struct latex {
 	size_t		base_header_level; /* header offset */
 };
 
-static void
-rndr_escape_text(struct lowdown_buf *ob, const char *data, size_t sz)
+/*
+ * Escape LaTeX special characters in "data" of size "sz".
+ */
+void
+hesc_latex(struct lowdown_buf *ob, const char *data, size_t sz)
 {
 	size_t	 i;
 
@@ -72,7 +75,7 @@ static void
 rndr_escape(struct lowdown_buf *ob, const struct lowdown_buf *dat)
 {
 	
-	rndr_escape_text(ob, dat->data, dat->size);
+	hesc_latex(ob, dat->data, dat->size);
 }
 
 static void
@@ -415,9 +418,9 @@ rndr_image(struct lowdown_buf *ob, const struct rndr_image *p)
 	HBUF_PUTSL(ob, "]{");
 	if ((cp = memrchr(p->link.data, '.', p->link.size)) != NULL) {
 		HBUF_PUTSL(ob, "{");
-		rndr_escape_text(ob, p->link.data, cp - p->link.data);
+		hesc_latex(ob, p->link.data, cp - p->link.data);
 		HBUF_PUTSL(ob, "}");
-		rndr_escape_text(ob, cp, p->link.size - (cp - p->link.data));
+		hesc_latex(ob, cp, p->link.size - (cp - p->link.data));
 	} else
 		rndr_escape(ob, &p->link);
 	HBUF_PUTSL(ob, "}");
@@ -499,7 +502,9 @@ rndr_footnote_def(struct lowdown_buf *ob,
 	const struct lowdown_buf *content, size_t num)
 {
 
-	hbuf_printf(ob, "\\footnotetext[%zu]{", num);
+	HBUF_PUTSL(ob, "\\footnotetext[");
+	hbuf_putu(ob, num);
+	HBUF_PUTSL(ob, "]{");
 	hbuf_putb(ob, content);
 	HBUF_PUTSL(ob, "}\n");
 }
@@ -508,7 +513,9 @@ static void
 rndr_footnote_ref(struct lowdown_buf *ob, size_t num)
 {
 
-	hbuf_printf(ob, "\\footnotemark[%zu]", num);
+	HBUF_PUTSL(ob, "\\footnotemark[");
+	hbuf_putu(ob, num);
+	hbuf_putc(ob, ']');
 }
 
 static void
@@ -629,13 +636,18 @@ rndr(struct lowdown_buf *ob,
 	struct lowdown_buf		*tmp;
 	struct latex			*st = arg;
 	const struct lowdown_node	*child;
+	struct lowdown_node		*row;
 	const char			*tex;
 	unsigned char			 texflags;
 
 	tmp = hbuf_new(64);
 
-	TAILQ_FOREACH(child, &n->children, entries)
-		rndr(tmp, mq, st, child);
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		if ((row = table_row_expand(child)) != NULL) {
+			rndr(tmp, mq, st, row);
+			lowdown_node_free(row);
+		} else
+			rndr(tmp, mq, st, child);
 
 	/*
 	 * These elements can be put in either a block or an inline
@@ -793,7 +805,9 @@ lowdown_latex_rndr(struct lowdown_buf *ob,
 	}
 
 	st->base_header_level = 1;
+	LOWDOWN_PROBE2(render__start, "latex", n->id);
 	rndr(ob, mq, st, n);
+	LOWDOWN_PROBE2(render__done, "latex", ob->size);
 
 	/* Release temporary metaq. */
 
@@ -40,94 +40,172 @@
  */
 #define HBUF_START_SMALL 128
 
+/*
+ * Render "n" into "ob" with the renderer chosen by "opts", which may be
+ * NULL for HTML with default flags.
+ */
 void
-lowdown_buf(const struct lowdown_opts *opts,
-	const char *data, size_t datasz,
-	char **res, size_t *rsz,
-	struct lowdown_metaq *metaq)
+library_rndr(struct lowdown_buf *ob, struct lowdown_metaq *metaq,
+	const struct lowdown_opts *opts, struct lowdown_node *n)
 {
-	struct lowdown_buf	*ob;
-	void			*renderer = NULL;
-	struct lowdown_doc	*document;
-	size_t			 maxn;
-	enum lowdown_type	 t;
-	struct lowdown_node	*n;
-
-	/* Create our buffers, renderer, and document. */
+	void			*renderer;
 
-	ob = lowdown_buf_new(HBUF_START_BIG);
-	document = lowdown_doc_new(opts);
-	t = opts == NULL ? LOWDOWN_HTML : opts->type;
-
-	switch (t) {
+	switch (opts == NULL ? LOWDOWN_HTML : opts->type) {
 	case LOWDOWN_GEMINI:
 		renderer = lowdown_gemini_new(opts);
+		lowdown_gemini_rndr(ob, metaq, renderer, n);
+		lowdown_gemini_free(renderer);
 		break;
 	case LOWDOWN_HTML:
 		renderer = lowdown_html_new(opts);
+		lowdown_html_rndr(ob, metaq, renderer, n);
+		lowdown_html_free(renderer);
+		break;
+	case LOWDOWN_TOC:
+		renderer = lowdown_html_new(opts);
+		lowdown_html_toc(ob, renderer, n);
+		lowdown_html_free(renderer);
 		break;
 	case LOWDOWN_LATEX:
 		renderer = lowdown_latex_new(opts);
+		lowdown_latex_rndr(ob, metaq, renderer, n);
+		lowdown_latex_free(renderer);
+		break;
+	case LOWDOWN_LINKS:
+		lowdown_links_rndr(ob, n);
 		break;
 	case LOWDOWN_MAN:
 	case LOWDOWN_NROFF:
 		renderer = lowdown_nroff_new(opts);
+		lowdown_nroff_rndr(ob, metaq, renderer, n);
+		lowdown_nroff_free(renderer);
+		break;
+	case LOWDOWN_PLAIN:
+		renderer = lowdown_plain_new(opts);
+		lowdown_plain_rndr(ob, metaq, renderer, n);
+		lowdown_plain_free(renderer);
 		break;
 	case LOWDOWN_TERM:
 		renderer = lowdown_term_new(opts);
+		lowdown_term_rndr(ob, metaq, renderer, n);
+		lowdown_term_free(renderer);
 		break;
 	case LOWDOWN_TREE:
 		renderer = lowdown_tree_new();
+		lowdown_tree_rndr(ob, metaq, renderer, n);
+		lowdown_tree_free(renderer);
 		break;
 	default:
 		break;
 	}
+}
 
-	/* Parse the output and free resources. */
+/*
+ * Parse "data" into a tree for rendering with "opts".
+ * The document is returned in "doc" and must be kept until the tree
+ * has been rendered: table body rows are left unparsed until then.
+ * The options it uses may be copied into "lazy", which must also
+ * outlive the document.
+ */
+struct lowdown_node *
+library_parse(const struct lowdown_opts *opts, struct lowdown_opts *lazy,
+	struct lowdown_doc **doc, const char *data, size_t datasz)
+{
+	struct lowdown_node	*n;
 
-	n = lowdown_doc_parse(document, &maxn, data, datasz);
+	/*
+	 * A table of contents only needs headers, so leave all other
+	 * inline content unparsed.
+	 * Links only need inline content that might have links, which
+	 * lowdown_links_next() checks before parsing, and don't need
+	 * smartypants at all.
+	 */
+
+	if (opts != NULL &&
+	    (opts->type == LOWDOWN_TOC || opts->type == LOWDOWN_LINKS)) {
+		*lazy = *opts;
+		lazy->feat |= LOWDOWN_LAZY;
+		if (lazy->type == LOWDOWN_LINKS)
+			lazy->oflags &= ~LOWDOWN_SMARTY;
+		opts = lazy;
+	}
+
+	*doc = lowdown_doc_new(opts);
+	doc_render(*doc);
+	if (opts != NULL && (opts->oflags & LOWDOWN_SMARTY))
+		doc_pass(*doc, DOC_PASS_SMARTY);
+	n = lowdown_doc_parse(*doc, NULL, data, datasz);
 	assert(n == NULL || n->type == LOWDOWN_ROOT);
-	lowdown_doc_free(document);
+	return n;
+}
 
-	/* Conditionally apply smartypants. */
+/*
+ * Parse "new" and "old" and return their difference tree, ready for
+ * rendering with "opts".
+ * The parsed trees are returned in "nnew" and "nold" for the caller to
+ * free.
+ */
+struct lowdown_node *
+library_diff(const struct lowdown_opts *opts,
+	const char *new, size_t newsz, const char *old, size_t oldsz,
+	struct lowdown_node **nnew, struct lowdown_node **nold)
+{
+	struct lowdown_doc 	*doc, *olddoc;
+	struct lowdown_node 	*ndiff;
+	size_t			 maxnew, maxold, maxn;
+	struct lowdown_opts	 eager;
+
+	/*
+	 * Don't parse lazily: the difference algorithm needs identifiers
+	 * in document order.
+	 * Adjacent text nodes are merged while parsing.
+	 * With LOWDOWN_INTERN, both trees share their strings, so equal
+	 * ones are also equal by pointer.
+	 */
+
+	if (opts != NULL) {
+		eager = *opts;
+		eager.feat &= ~LOWDOWN_LAZY;
+	}
+
+	doc = lowdown_doc_new(opts == NULL ? NULL : &eager);
+	doc_pass(doc, DOC_PASS_MERGE_TEXT);
+	*nnew = lowdown_doc_parse(doc, &maxnew, new, newsz);
+
+	olddoc = lowdown_doc_new(opts == NULL ? NULL : &eager);
+	doc_share_strings(olddoc, doc);
+	lowdown_doc_free(doc);
+	doc_pass(olddoc, DOC_PASS_MERGE_TEXT);
+	*nold = lowdown_doc_parse(olddoc, &maxold, old, oldsz);
+	lowdown_doc_free(olddoc);
+
+	ndiff = lowdown_diff(*nold, *nnew, &maxn);
 
     	if (opts != NULL && 
 	    (opts->oflags & LOWDOWN_SMARTY)) 
-		smarty(n, maxn, t);
+		smarty(ndiff, maxn, opts->type);
 
-	/* Render to output. */
+	return ndiff;
+}
 
-	switch (t) {
-	case LOWDOWN_GEMINI:
-		lowdown_gemini_rndr(ob, metaq, renderer, n);
-		lowdown_gemini_free(renderer);
-		break;
-	case LOWDOWN_HTML:
-		lowdown_html_rndr(ob, metaq, renderer, n);
-		lowdown_html_free(renderer);
-		break;
-	case LOWDOWN_LATEX:
-		lowdown_latex_rndr(ob, metaq, renderer, n);
-		lowdown_latex_free(renderer);
-		break;
-	case LOWDOWN_MAN:
-	case LOWDOWN_NROFF:
-		lowdown_nroff_rndr(ob, metaq, renderer, n);
-		lowdown_nroff_free(renderer);
-		break;
-	case LOWDOWN_TERM:
-		lowdown_term_rndr(ob, metaq, renderer, n);
-		lowdown_term_free(renderer);
-		break;
-	case LOWDOWN_TREE:
-		lowdown_tree_rndr(ob, metaq, renderer, n);
-		lowdown_tree_free(renderer);
-		break;
-	default:
-		break;
-	}
+void
+lowdown_buf(const struct lowdown_opts *opts,
+	const char *data, size_t datasz,
+	char **res, size_t *rsz,
+	struct lowdown_metaq *metaq)
+{
+	struct lowdown_buf	*ob;
+	struct lowdown_doc	*document;
+	struct lowdown_node	*n;
+	struct lowdown_opts	 lazy;
+
+	n = library_parse(opts, &lazy, &document, data, datasz);
+
+	ob = lowdown_buf_new(HBUF_START_BIG);
+	library_rndr(ob, metaq, opts, n);
 
 	lowdown_node_free(n);
+	lowdown_doc_free(document);
 
 	*res = ob->data;
 	*rsz = ob->size;
@@ -135,42 +213,6 @@ lowdown_buf(const struct lowdown_opts *opts,
 	lowdown_buf_free(ob);
 }
 
-/*
- * Merge adjacent text nodes into single text nodes, freeing the
- * duplicates along the way.
- * This is only used when diffing, as it makes the diff algorithm hvae a
- * more reasonable view of text in the tree.
- */
-static void
-lowdown_merge_adjacent_text(struct lowdown_node *n)
-{
-	struct lowdown_node 	*nn, *next;
-	struct lowdown_buf	*nb, *nextbuf;
-
-	TAILQ_FOREACH(nn, &n->children, entries) {
-		if (nn->type != LOWDOWN_NORMAL_TEXT) {
-			lowdown_merge_adjacent_text(nn);
-			continue;
-		}
-		nb = &nn->rndr_normal_text.text;
-		for (;;) {
-			next = TAILQ_NEXT(nn, entries);
-			if (next  == NULL ||
-			    next->type != LOWDOWN_NORMAL_TEXT)
-				break;
-			nextbuf = &next->rndr_normal_text.text;
-			TAILQ_REMOVE(&n->children, next, entries);
-			nb->data = xrealloc(nb->data, 
-				nb->size + nextbuf->size + 1);
-			memcpy(nb->data + nb->size,
-				nextbuf->data, nextbuf->size);
-			nb->data[nb->size + nextbuf->size] = '\0';
-			nb->size += nextbuf->size;
-			lowdown_node_free(next);
-		}
-	}
-}
-
 void
 lowdown_buf_diff(const struct lowdown_opts *opts,
 	const char *new, size_t newsz,
@@ -179,95 +221,16 @@ lowdown_buf_diff(const struct lowdown_opts *opts,
 	struct lowdown_metaq *metaq)
 {
 	struct lowdown_buf 	*ob;
-	void 		 	*renderer = NULL;
-	struct lowdown_doc 	*doc;
-	enum lowdown_type 	 t;
 	struct lowdown_node 	*nnew, *nold, *ndiff;
-	size_t			 maxnew, maxold, maxn;
-
-	t = opts == NULL ? LOWDOWN_HTML : opts->type;
-
-	switch (t) {
-	case LOWDOWN_GEMINI:
-		renderer = lowdown_gemini_new(opts);
-		break;
-	case LOWDOWN_HTML:
-		renderer = lowdown_html_new(opts);
-		break;
-	case LOWDOWN_LATEX:
-		renderer = lowdown_latex_new(opts);
-		break;
-	case LOWDOWN_MAN:
-	case LOWDOWN_NROFF:
-		renderer = lowdown_nroff_new(opts);
-		break;
-	case LOWDOWN_TERM:
-		renderer = lowdown_term_new(opts);
-		break;
-	case LOWDOWN_TREE:
-		renderer = lowdown_tree_new();
-		break;
-	default:
-		break;
-	}
-
-	/* Parse the output and free resources. */
-
-	doc = lowdown_doc_new(opts);
-	nnew = lowdown_doc_parse(doc, &maxnew, new, newsz);
-	lowdown_doc_free(doc);
-
-	doc = lowdown_doc_new(opts);
-	nold = lowdown_doc_parse(doc, &maxold, old, oldsz);
-	lowdown_doc_free(doc);
-
-	/* Merge adjacent text nodes. */
-
-	lowdown_merge_adjacent_text(nnew);
-	lowdown_merge_adjacent_text(nold);
 
 	/* Get the difference tree and clear the old. */
 
-	ndiff = lowdown_diff(nold, nnew, &maxn);
+	ndiff = library_diff(opts, new, newsz, old, oldsz, &nnew, &nold);
 	lowdown_node_free(nnew);
 	lowdown_node_free(nold);
 
-    	if (opts != NULL && 
-	    (opts->oflags & LOWDOWN_SMARTY)) 
-		smarty(ndiff, maxn, t);
-
 	ob = lowdown_buf_new(HBUF_START_BIG);
-
-	switch (t) {
-	case LOWDOWN_GEMINI:
-		lowdown_gemini_rndr(ob, metaq, renderer, ndiff);
-		lowdown_gemini_free(renderer);
-		break;
-	case LOWDOWN_HTML:
-		lowdown_html_rndr(ob, metaq, renderer, ndiff);
-		lowdown_html_free(renderer);
-		break;
-	case LOWDOWN_LATEX:
-		lowdown_latex_rndr(ob, metaq, renderer, ndiff);
-		lowdown_latex_free(renderer);
-		break;
-	case LOWDOWN_MAN:
-	case LOWDOWN_NROFF:
-		lowdown_nroff_rndr(ob, metaq, renderer, ndiff);
-		lowdown_nroff_free(renderer);
-		break;
-	case LOWDOWN_TERM:
-		lowdown_term_rndr(ob, metaq, renderer, ndiff);
-		lowdown_term_free(renderer);
-		break;
-	case LOWDOWN_TREE:
-		lowdown_tree_rndr(ob, metaq, renderer, ndiff);
-		lowdown_tree_free(renderer);
-		break;
-	default:
-		break;
-	}
-
+	library_rndr(ob, metaq, opts, ndiff);
 	lowdown_node_free(ndiff);
 
 	*res = ob->data;
@@ -0,0 +1,118 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lowdown.h"
+#include "extern.h"
+
+/*
+ * Return the first link, autolink, or image following "n" in document
+ * (pre-order) order within "root", or within and including "root" if
+ * "n" is NULL.
+ * Returns NULL if there are no more.
+ * This walks the tree by parent pointers, so it uses constant space.
+ * Inline content left unparsed with LOWDOWN_LAZY is only parsed if it
+ * may contain links.
+ * This is the only modification made to the tree, as with
+ * lowdown_node_children().
+ */
+const struct lowdown_node *
+lowdown_links_next(const struct lowdown_node *root,
+	const struct lowdown_node *n)
+{
+	const struct lowdown_node	*next;
+
+	for (;;) {
+		if (n == NULL)
+			n = root;
+		else if (lazy_links(n) && (next =
+		    TAILQ_FIRST(lowdown_node_children(n))) != NULL)
+			n = next;
+		else {
+			while (n != root && TAILQ_NEXT(n, entries) == NULL)
+				n = n->parent;
+			if (n == root)
+				return NULL;
+			n = TAILQ_NEXT(n, entries);
+		}
+
+		/* Compact table rows are expanded if need be. */
+
+		n = table_row_links(n);
+
+		switch (n->type) {
+		case LOWDOWN_IMAGE:
+		case LOWDOWN_LINK:
+		case LOWDOWN_LINK_AUTO:
+			return n;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * Write each link, autolink, and image under "root" on its own line as
+ * its node identifier, type, and address separated by tabs.
+ * E-mail autolinks are given as "mailto:" addresses.
+ * With LOWDOWN_LAZY, identifiers of content parsed as it's reached come
+ * after all others, so they're unique but not in document order.
+ */
+void
+lowdown_links_rndr(struct lowdown_buf *ob,
+	const struct lowdown_node *root)
+{
+	const struct lowdown_node	*n = NULL;
+	const struct lowdown_buf	*link;
+
+	LOWDOWN_PROBE2(render__start, "links", root->id);
+
+	while ((n = lowdown_links_next(root, n)) != NULL) {
+		hbuf_putu(ob, n->id);
+		hbuf_putc(ob, '\t');
+		switch (n->type) {
+		case LOWDOWN_IMAGE:
+			HBUF_PUTSL(ob, "image\t");
+			link = &n->rndr_image.link;
+			break;
+		case LOWDOWN_LINK:
+			HBUF_PUTSL(ob, "link\t");
+			link = &n->rndr_link.link;
+			break;
+		default:
+			HBUF_PUTSL(ob, "autolink\t");
+			link = &n->rndr_autolink.link;
+			if (n->rndr_autolink.type == HALINK_EMAIL &&
+			    !hbuf_strprefix(link, "mailto:"))
+				HBUF_PUTSL(ob, "mailto:");
+			break;
+		}
+		hbuf_putb(ob, link);
+		hbuf_putc(ob, '\n');
+	}
+
+	LOWDOWN_PROBE2(render__done, "links", ob->size);
+}
@@ -48,7 +48,10 @@ enum	lowdown_type {
 	LOWDOWN_NROFF,
 	LOWDOWN_TERM,
 	LOWDOWN_TREE,
-	LOWDOWN_NULL
+	LOWDOWN_NULL,
+	LOWDOWN_LINKS,
+	LOWDOWN_PLAIN,
+	LOWDOWN_TOC
 };
 
 /*
@@ -99,7 +102,7 @@ enum	lowdown_rndrt {
 struct	lowdown_buf {
 	char		*data;	/* actual character data */
 	size_t		 size;	/* size of the string */
-	size_t		 asize;	/* allocated size (0 = volatile) */
+	size_t		 asize;	/* allocated size (0 = volatile, -1 = shared) */
 	size_t		 unit;	/* realloc unit size (0 = read-only) */
 	int 		 buffer_free; /* obj should be freed */
 };
@@ -145,13 +148,21 @@ enum	lowdown_chng {
 	LOWDOWN_CHNG_DELETE,
 };
 
+struct	lowdown_lazy;
+
 struct	rndr_meta {
 	struct lowdown_buf key;
 };
 
+/*
+ * With LOWDOWN_LAZY, the children of paragraphs, headers, and table
+ * cells may be left unparsed ("lazy" is non-NULL): access them with
+ * lowdown_node_children().
+ */
 struct	rndr_paragraph {
 	size_t lines; /* input lines */
 	int beoln; /* ends on blank line */
+	struct lowdown_lazy *lazy; /* unparsed children (or NULL) */
 };
 
 struct	rndr_normal_text {
@@ -200,10 +211,25 @@ struct	rndr_table_header {
 	size_t columns; /* number of columns */
 };
 
+struct	lowdown_doc;
+
+/*
+ * A body row kept unparsed (compact) when doc is non-NULL.
+ * This is only produced internally, by lowdown_buf() and
+ * lowdown_doc_events(), for table rows without '[' and never with
+ * LOWDOWN_SRCPOS: renderers expand each row into cells as they go,
+ * parsing it again on each traversal.
+ */
+struct	rndr_table_row {
+	struct lowdown_buf text; /* raw row (if compact) */
+	struct lowdown_doc *doc; /* parser (if compact) */
+};
+
 struct	rndr_table_cell {
 	enum htbl_flags flags; /* flags for cell */
 	size_t col; /* column number */
 	size_t columns; /* number of columns */
+	struct lowdown_lazy *lazy; /* unparsed children (or NULL) */
 };
 
 struct	rndr_footnote_def {
@@ -240,6 +266,7 @@ struct	rndr_listitem {
 
 struct	rndr_header{
 	size_t level; /* hN level */
+	struct lowdown_lazy *lazy; /* unparsed children (or NULL) */
 };
 
 struct	rndr_image {
@@ -256,6 +283,25 @@ struct rndr_math {
 	int blockmode;
 };
 
+/*
+ * Position of a node in the input document with LOWDOWN_SRCPOS.
+ * The end of the node is given relative to its start.
+ * Nodes not from the input (or past 4 GB into it) have a zero line.
+ * As most parses don't ask for them, positions are kept out of the
+ * nodes in a table held by the root: see lowdown_node_pos().
+ */
+struct	lowdown_pos {
+	unsigned int	 off; /* byte offset of start */
+	unsigned int	 len; /* bytes to end */
+	unsigned int	 line; /* line of start (from 1) */
+	unsigned int	 lines; /* lines to last line */
+};
+
+struct	rndr_root {
+	struct lowdown_pos *pos; /* by id less root's (or NULL) */
+	size_t posz; /* entries in pos */
+};
+
 /*
  * Node parsed from input document.
  * Each node is part of the parse tree.
@@ -265,6 +311,7 @@ struct	lowdown_node {
 	enum lowdown_chng	 chng; /* change type */
 	size_t			 id; /* unique identifier */
 	union {
+		struct rndr_root rndr_root;
 		struct rndr_meta rndr_meta;
 		struct rndr_list rndr_list; 
 		struct rndr_paragraph rndr_paragraph;
@@ -280,6 +327,7 @@ struct	lowdown_node {
 		struct rndr_codespan rndr_codespan; 
 		struct rndr_table rndr_table; 
 		struct rndr_table_header rndr_table_header; 
+		struct rndr_table_row rndr_table_row;
 		struct rndr_table_cell rndr_table_cell; 
 		struct rndr_footnote_def rndr_footnote_def;
 		struct rndr_footnote_ref rndr_footnote_ref;
@@ -319,6 +367,9 @@ struct	lowdown_opts {
 #define	LOWDOWN_COMMONMARK	 0x8000
 #define	LOWDOWN_DEFLIST		 0x10000
 #define	LOWDOWN_IMG_EXT	 	 0x20000
+#define	LOWDOWN_LAZY	 	 0x40000 /* see lowdown_node_children() */
+#define	LOWDOWN_SRCPOS	 	 0x80000 /* see lowdown_pos */
+#define	LOWDOWN_INTERN	 	 0x100000 /* share repeated link strings */
 	unsigned int		 oflags;
 #define LOWDOWN_HTML_SKIP_HTML	 0x01 /* skip all HTML */
 #define LOWDOWN_HTML_ESCAPE	 0x02 /* escape HTML (if not skip) */
@@ -337,10 +388,44 @@ struct	lowdown_opts {
 #define LOWDOWN_LATEX_NUMBERED	 0x4000 /* numbered sections */
 #define	LOWDOWN_GEMINI_LINK_END	 0x8000 /* links at end */
 #define	LOWDOWN_GEMINI_LINK_IN	 0x10000 /* links inline */
+#define	LOWDOWN_PLAIN_JSON	 0x20000 /* json record per section */
+#define	LOWDOWN_HTML_COMPACT	 0x40000 /* no whitespace between blocks */
 };
 
 struct lowdown_doc;
 
+/*
+ * Callbacks for lowdown_doc_events(), each of which may be NULL.
+ * The "text" callback is invoked after "enter" for nodes with literal
+ * text: normal text, code spans and blocks, and equations.
+ */
+struct	lowdown_events {
+	void	(*enter)(void *, const struct lowdown_node *);
+	void	(*text)(void *, const struct lowdown_node *,
+			const struct lowdown_buf *);
+	void	(*leave)(void *, const struct lowdown_node *);
+	void	 *arg; /* passed to callbacks */
+};
+
+enum	lowdown_iter_event {
+	LOWDOWN_ITER_DONE = 0, /* no more nodes */
+	LOWDOWN_ITER_ENTER, /* node before its children */
+	LOWDOWN_ITER_LEAVE /* node after its children */
+};
+
+/*
+ * Tree iterator used with lowdown_iter_next().
+ * It walks by parent pointers, so needs no stack, and keeps only the
+ * current position: the tree mustn't be modified while it's in use,
+ * except that children left unparsed with LOWDOWN_LAZY are parsed as
+ * they're reached.
+ */
+struct	lowdown_iter {
+	const struct lowdown_node *root; /* top of walk */
+	const struct lowdown_node *node; /* current node */
+	enum lowdown_iter_event	   event; /* current event */
+};
+
 __BEGIN_DECLS
 
 /*
@@ -374,19 +459,37 @@ struct lowdown_doc
 struct lowdown_node
 	*lowdown_doc_parse(struct lowdown_doc *,
 		size_t *, const char *, size_t);
+void	 lowdown_doc_events(struct lowdown_doc *,
+		const struct lowdown_events *, const char *, size_t);
 struct lowdown_node
 	*lowdown_diff(const struct lowdown_node *,
 		const struct lowdown_node *, size_t *);
 void	 lowdown_doc_free(struct lowdown_doc *);
 void	 lowdown_metaq_free(struct lowdown_metaq *);
 
+const struct lowdown_node
+	*lowdown_links_next(const struct lowdown_node *,
+		const struct lowdown_node *);
+void	 lowdown_links_rndr(struct lowdown_buf *,
+		const struct lowdown_node *);
+
 void 	 lowdown_node_free(struct lowdown_node *);
+const struct lowdown_nodeq
+	*lowdown_node_children(const struct lowdown_node *);
+int	 lowdown_node_pos(const struct lowdown_node *,
+		struct lowdown_pos *);
+void	 lowdown_iter_init(struct lowdown_iter *,
+		const struct lowdown_node *);
+enum lowdown_iter_event
+	 lowdown_iter_next(struct lowdown_iter *);
 
 void	 lowdown_html_free(void *);
 void	*lowdown_html_new(const struct lowdown_opts *);
 void 	 lowdown_html_rndr(struct lowdown_buf *,
 		struct lowdown_metaq *, void *, 
 		const struct lowdown_node *);
+void 	 lowdown_html_toc(struct lowdown_buf *, void *,
+		const struct lowdown_node *);
 
 void	 lowdown_gemini_free(void *);
 void	*lowdown_gemini_new(const struct lowdown_opts *);
@@ -406,6 +509,12 @@ void 	 lowdown_nroff_rndr(struct lowdown_buf *,
 		struct lowdown_metaq *, void *, 
 		struct lowdown_node *);
 
+void	 lowdown_plain_free(void *);
+void	*lowdown_plain_new(const struct lowdown_opts *);
+void 	 lowdown_plain_rndr(struct lowdown_buf *, 
+		struct lowdown_metaq *, void *, 
+		const struct lowdown_node *);
+
 void	 lowdown_tree_free(void *);
 void	*lowdown_tree_new(void);
 void 	 lowdown_tree_rndr(struct lowdown_buf *, 
@@ -44,6 +44,7 @@
 #include <unistd.h>
 
 #include "lowdown.h"
+#include "extern.h"
 
 /*
  * Start with all of the sandboxes.
@@ -164,6 +165,8 @@ feature_out(const char *v)
 		return LOWDOWN_HTML_HARD_WRAP;
 	if (strcasecmp(v, "html-head-ids") == 0)
 		return LOWDOWN_HTML_HEAD_IDS;
+	if (strcasecmp(v, "html-compact") == 0)
+		return LOWDOWN_HTML_COMPACT;
 	if (strcasecmp(v, "nroff-skiphtml") == 0)
 		return LOWDOWN_NROFF_SKIP_HTML;
 	if (strcasecmp(v, "nroff-hardwrap") == 0)
@@ -235,9 +238,12 @@ main(int argc, char *argv[])
 	struct lowdown_opts 	 opts;
 	int			 c, diff = 0,
 				 status = EXIT_SUCCESS, feat, aoflag = 0, roflag = 0,
-				 aiflag = 0, riflag = 0, centre = 0;
-	char			*ret = NULL;
-	size_t		 	 retsz = 0, rcols;
+				 aiflag = 0, riflag = 0, centre = 0, dofree = 0;
+	size_t		 	 rcols;
+	struct lowdown_buf	*ib, *dib = NULL, *ob;
+	struct lowdown_doc	*doc = NULL;
+	struct lowdown_node	*n, *nnew = NULL, *nold = NULL;
+	struct lowdown_opts	 lazy;
 	struct lowdown_meta 	*m;
 	struct lowdown_metaq	 mq;
 	struct option 		 lo[] = {
@@ -249,6 +255,8 @@ main(int argc, char *argv[])
 		{ "html-no-hardwrap",	no_argument,	&roflag, LOWDOWN_HTML_HARD_WRAP },
 		{ "html-head-ids",	no_argument,	&aoflag, LOWDOWN_HTML_HEAD_IDS },
 		{ "html-no-head-ids",	no_argument,	&roflag, LOWDOWN_HTML_HEAD_IDS },
+		{ "html-compact",	no_argument,	&aoflag, LOWDOWN_HTML_COMPACT },
+		{ "html-no-compact",	no_argument,	&roflag, LOWDOWN_HTML_COMPACT },
 		{ "html-owasp",		no_argument,	&aoflag, LOWDOWN_HTML_OWASP },
 		{ "html-no-owasp",	no_argument,	&roflag, LOWDOWN_HTML_OWASP },
 		{ "html-num-ent",	no_argument,	&aoflag, LOWDOWN_HTML_NUM_ENT },
@@ -273,6 +281,8 @@ main(int argc, char *argv[])
 		{ "gemini-no-link-end",	no_argument, 	&roflag, LOWDOWN_GEMINI_LINK_END },
 		{ "gemini-link-inline",	no_argument, 	&aoflag, LOWDOWN_GEMINI_LINK_IN },
 		{ "gemini-no-link-inline",no_argument, 	&roflag, LOWDOWN_GEMINI_LINK_IN },
+		{ "plain-json",		no_argument, 	&aoflag, LOWDOWN_PLAIN_JSON },
+		{ "plain-no-json",	no_argument, 	&roflag, LOWDOWN_PLAIN_JSON },
 		{ "term-shortlinks",	no_argument, 	&aoflag, LOWDOWN_TERM_SHORTLINK },
 		{ "term-no-shortlinks",	no_argument, 	&roflag, LOWDOWN_TERM_SHORTLINK },
 		{ "out-smarty",		no_argument,	&aoflag, LOWDOWN_SMARTY },
@@ -307,6 +317,12 @@ main(int argc, char *argv[])
 		{ "parse-no-deflists",	no_argument,	&riflag, LOWDOWN_DEFLIST },
 		{ "parse-img-ext",	no_argument,	&aiflag, LOWDOWN_IMG_EXT },
 		{ "parse-no-img-ext",	no_argument,	&riflag, LOWDOWN_IMG_EXT },
+		{ "parse-free",		no_argument,	&dofree, 1 },
+		{ "parse-no-free",	no_argument,	&dofree, 0 },
+		{ "parse-intern",	no_argument,	&aiflag, LOWDOWN_INTERN },
+		{ "parse-no-intern",	no_argument,	&riflag, LOWDOWN_INTERN },
+		{ "parse-srcpos",	no_argument,	&aiflag, LOWDOWN_SRCPOS },
+		{ "parse-no-srcpos",	no_argument,	&riflag, LOWDOWN_SRCPOS },
 		{ "parse-maxdepth",	required_argument, NULL, 5 },
 		{ NULL,			0,	NULL,	0 }
 	};
@@ -386,10 +402,16 @@ main(int argc, char *argv[])
 				opts.type = LOWDOWN_HTML;
 			else if (strcasecmp(optarg, "latex") == 0)
 				opts.type = LOWDOWN_LATEX;
+			else if (strcasecmp(optarg, "links") == 0)
+				opts.type = LOWDOWN_LINKS;
 			else if (strcasecmp(optarg, "man") == 0)
 				opts.type = LOWDOWN_MAN;
+			else if (strcasecmp(optarg, "plain") == 0)
+				opts.type = LOWDOWN_PLAIN;
 			else if (strcasecmp(optarg, "term") == 0)
 				opts.type = LOWDOWN_TERM;
+			else if (strcasecmp(optarg, "toc") == 0)
+				opts.type = LOWDOWN_TOC;
 			else if (strcasecmp(optarg, "tree") == 0)
 				opts.type = LOWDOWN_TREE;
 			else if (strcasecmp(optarg, "null") == 0)
@@ -512,14 +534,35 @@ main(int argc, char *argv[])
 	if (extract)
 		opts.feat |= LOWDOWN_METADATA;
 
+	ib = lowdown_buf_new(4096);
+	if (hbuf_putf(ib, fin))
+		err(EXIT_FAILURE, "%s", fnin);
+
 	if (diff) {
-		if (!lowdown_file_diff
-		    (&opts, fin, din, &ret, &retsz, &mq))
-			err(EXIT_FAILURE, "%s", fnin);
-	} else {
-		if (!lowdown_file(&opts, fin, &ret, &retsz, &mq))
-			err(EXIT_FAILURE, "%s", fnin);
+		dib = lowdown_buf_new(4096);
+		if (hbuf_putf(dib, din))
+			err(EXIT_FAILURE, "%s", fndin);
+		n = library_diff(&opts, ib->data, ib->size,
+			dib->data, dib->size, &nnew, &nold);
+	} else
+		n = library_parse(&opts, &lazy, &doc, ib->data, ib->size);
+
+	ob = lowdown_buf_new(4096);
+	library_rndr(ob, &mq, &opts, n);
+
+	/*
+	 * We exit right after, so only free the trees if asked to, for
+	 * memory checkers: it's faster to leave them to the operating
+	 * system.
+	 */
+
+	if (dofree) {
+		lowdown_node_free(n);
+		lowdown_node_free(nnew);
+		lowdown_node_free(nold);
 	}
+	if (doc != NULL)
+		lowdown_doc_free(doc);
 
 	if (extract != NULL) {
 		TAILQ_FOREACH(m, &mq, entries) 
@@ -532,9 +575,11 @@ main(int argc, char *argv[])
 			warnx("%s: unknown keyword", extract);
 		}
 	} else
-		fwrite(ret, 1, retsz, fout);
+		fwrite(ob->data, 1, ob->size, fout);
 
-	free(ret);
+	lowdown_buf_free(ob);
+	lowdown_buf_free(ib);
+	lowdown_buf_free(dib);
 	if (fout != stdout)
 		fclose(fout);
 	if (din != NULL)
@@ -0,0 +1,542 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <limits.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lowdown.h"
+#include "extern.h"
+#include "bench.h"
+
+/*
+ * Microbenchmarks for the leaf routines: escaping, entity lookup,
+ * autolink detection, terminal width computation, parsing, and tree
+ * traversal.
+ * Each kernel is run over generated inputs with different byte
+ * distributions and the results are printed as JSON.
+ */
+
+/*
+ * Text is passed to the escaping kernels in pieces of this size, which
+ * is about that of a text node in ordinary documents.
+ */
+#define	CHUNK	64
+
+/*
+ * Size of each generated input.
+ */
+#define	INSZ	(64 * 1024)
+
+enum	input {
+	IN_ASCII, /* plain English text */
+	IN_MARKUP, /* text dense with escapable characters */
+	IN_UTF8, /* multi-byte text */
+	IN_RANDOM, /* random non-nul bytes */
+	IN_ENT_NAMED, /* valid named entities */
+	IN_ENT_NUM, /* valid numeric entities */
+	IN_ENT_BAD, /* invalid entities */
+	IN_LINKS, /* text with URLs, www-links, and e-mails */
+	IN_TRIGGERS, /* autolink triggers without links */
+	IN_DEEP, /* ever more deeply-nested block quotes */
+	IN__MAX
+};
+
+static const char *const inputs[IN__MAX] = {
+	"ascii", /* IN_ASCII */
+	"markup", /* IN_MARKUP */
+	"utf8", /* IN_UTF8 */
+	"random", /* IN_RANDOM */
+	"ent-named", /* IN_ENT_NAMED */
+	"ent-num", /* IN_ENT_NUM */
+	"ent-bad", /* IN_ENT_BAD */
+	"links", /* IN_LINKS */
+	"triggers", /* IN_TRIGGERS */
+	"deep", /* IN_DEEP */
+};
+
+/*
+ * Text fragments making up each input class.
+ * The generator picks randomly among them until the input is full.
+ * The random and deep input classes are generated separately.
+ */
+static const char *const frags[IN__MAX][9] = {
+	/* IN_ASCII */
+	{ "the ", "quick ", "brown ", "fox ", "jumps ", "over ",
+	  "lazy ", "dogs. ", NULL },
+	/* IN_MARKUP */
+	{ "<a href=\"x\">", "&amp; ", "'q' ", "a/b\\c ", "~`^ ",
+	  "{%$#_} ", ".start\n", "5 > 3 < 4 ", NULL },
+	/* IN_UTF8 */
+	{ "naïve ", "café ", "Ωμέγα ", "日本語 ", "über ", "emoji 😀 ",
+	  "ascii ", "Ελληνικά ", NULL },
+	/* IN_RANDOM */
+	{ NULL },
+	/* IN_ENT_NAMED */
+	{ "&amp;", "&lt;", "&gt;", "&quot;", "&copy;", "&eacute;",
+	  "&hellip;", "&zwnj;", NULL },
+	/* IN_ENT_NUM */
+	{ "&#38;", "&#60;", "&#x3C;", "&#169;", "&#x1F600;", "&#8230;",
+	  "&#X27;", "&#233;", NULL },
+	/* IN_ENT_BAD */
+	{ "&nosuch;", "&#xZZ;", "&;", "&#;", "&amp", "&toolongname;",
+	  "&#99999999;", "&a1;", NULL },
+	/* IN_LINKS */
+	{ "see http://example.com/a/b?c=d ", "www.example.org/path ",
+	  "mail kristaps@bsd.lv ", "https://bsd.lv. ", "and ",
+	  "ftp://ftp.example.com/file ", "words ", "(www.x.com) ", NULL },
+	/* IN_TRIGGERS */
+	{ "time: 10:30 ", "a@ ", "@@ ", "www ", "wwwx ", "x:y:z ",
+	  "user@ host ", "w.w.w ", NULL },
+	/* IN_DEEP */
+	{ NULL },
+};
+
+/*
+ * Fill "ob" with about INSZ bytes of input class "in".
+ */
+static void
+gen_input(struct lowdown_buf *ob, enum input in)
+{
+	size_t	 nfrags, depth, i;
+
+	bench_srand(2463534242U);
+
+	if (in == IN_RANDOM) {
+		while (ob->size < INSZ)
+			hbuf_putc(ob, (char)(1 + bench_rand(255)));
+		return;
+	}
+
+	/* Each line is a paragraph quoted one level deeper. */
+
+	if (in == IN_DEEP) {
+		for (depth = 1; ob->size < INSZ; depth++) {
+			for (i = 0; i < depth; i++)
+				hbuf_putc(ob, '>');
+			HBUF_PUTSL(ob, " the quick brown fox\n");
+		}
+		return;
+	}
+
+	for (nfrags = 0; frags[in][nfrags] != NULL; nfrags++)
+		continue;
+	while (ob->size < INSZ)
+		hbuf_puts(ob, frags[in][bench_rand(nfrags)]);
+}
+
+/*
+ * Print one result, with a leading comma if not the first.
+ * The "allocs" are the total over all iterations.
+ */
+static void
+result(int *first, const char *kernel, enum input in,
+	size_t bytes, size_t calls, size_t iters, uint64_t ns,
+	size_t allocs)
+{
+	double	 secs = ns / 1e9;
+
+	printf("%s    {\"kernel\": \"%s\", \"input\": \"%s\", "
+		"\"bytes\": %zu, \"calls\": %zu, \"iterations\": %zu, "
+		"\"seconds\": %.6f, \"mb_per_s\": %.3f, "
+		"\"ns_per_call\": %.2f, \"allocs_per_iter\": %zu}",
+		*first ? "" : ",\n", kernel, inputs[in], bytes, calls,
+		iters, secs, secs > 0.0 ? (bytes * (double)iters) /
+			(1024.0 * 1024.0) / secs : 0.0,
+		calls > 0 ? (double)ns / iters / calls : 0.0,
+		allocs / iters);
+	*first = 0;
+}
+
+/*
+ * Escaping kernels, applied in CHUNK-sized pieces.
+ */
+enum	esc {
+	ESC_HTML,
+	ESC_HREF,
+	ESC_ATTR,
+	ESC_NROFF,
+	ESC_LATEX,
+	ESC_MBSWIDTH,
+	ESC__MAX
+};
+
+static const char *const escs[ESC__MAX] = {
+	"hesc_html", /* ESC_HTML */
+	"hesc_href", /* ESC_HREF */
+	"hesc_attr", /* ESC_ATTR */
+	"hesc_nroff", /* ESC_NROFF */
+	"hesc_latex", /* ESC_LATEX */
+	"term_mbswidth", /* ESC_MBSWIDTH */
+};
+
+static void
+bench_esc(int *first, enum esc e, enum input in,
+	const struct lowdown_buf *data, size_t iters)
+{
+	struct lowdown_buf	*ob;
+	struct term		*term;
+	size_t			 i, off, sz, calls = 0, w = 0;
+	uint64_t		 start, ns;
+	size_t			 allocs;
+
+	ob = hbuf_new(INSZ * 4);
+	term = lowdown_term_new(NULL);
+
+	allocs = bench_allocs;
+	start = bench_now();
+	for (i = 0; i < iters; i++) {
+		hbuf_truncate(ob);
+		for (off = calls = 0; off < data->size; off += sz) {
+			sz = data->size - off < CHUNK ?
+				data->size - off : CHUNK;
+			calls++;
+			switch (e) {
+			case ESC_HTML:
+				hesc_html(ob, data->data + off,
+					sz, 1, 0, 0);
+				break;
+			case ESC_HREF:
+				hesc_href(ob, data->data + off, sz);
+				break;
+			case ESC_ATTR:
+				hesc_attr(ob, data->data + off, sz);
+				break;
+			case ESC_NROFF:
+				hesc_nroff(ob, data->data + off,
+					sz, 0, 0, 0);
+				break;
+			case ESC_LATEX:
+				hesc_latex(ob, data->data + off, sz);
+				break;
+			case ESC_MBSWIDTH:
+				w += term_mbswidth(term,
+					data->data + off, sz);
+				break;
+			default:
+				abort();
+			}
+		}
+	}
+	ns = bench_now() - start;
+	allocs = bench_allocs - allocs;
+
+	/* Keep the width sum from being optimised away. */
+
+	if (w == SIZE_MAX)
+		putchar('\0');
+
+	result(first, escs[e], in, data->size, calls, iters, ns, allocs);
+	lowdown_term_free(term);
+	hbuf_free(ob);
+}
+
+/*
+ * Entity lookup kernels, applied to each entity in the input.
+ */
+static void
+bench_ent(int *first, int tex, enum input in,
+	const struct lowdown_buf *data, size_t iters)
+{
+	struct lowdown_buf	 buf;
+	size_t			 i, off, end, calls = 0, found = 0;
+	uint64_t		 start, ns;
+	size_t			 allocs;
+	unsigned char		 fl;
+
+	memset(&buf, 0, sizeof(struct lowdown_buf));
+
+	allocs = bench_allocs;
+	start = bench_now();
+	for (i = 0; i < iters; i++)
+		for (off = calls = 0; off < data->size; off = end) {
+			for (end = off + 1; end < data->size; end++)
+				if (data->data[end] == '&')
+					break;
+			buf.data = data->data + off;
+			buf.size = end - off;
+			calls++;
+			if (tex)
+				found += entity_find_tex
+					(&buf, &fl) != NULL;
+			else
+				found += entity_find_iso(&buf) != -1;
+		}
+	ns = bench_now() - start;
+	allocs = bench_allocs - allocs;
+
+	if (found == SIZE_MAX)
+		putchar('\0');
+
+	result(first, tex ? "entity_find_tex" : "entity_find_iso",
+		in, data->size, calls, iters, ns, allocs);
+}
+
+/*
+ * Autolink kernels, invoked at each of their trigger characters just
+ * as the parser would: ':' for URLs, 'w' for www, '@' for e-mail.
+ */
+enum	link {
+	LINK_URL,
+	LINK_WWW,
+	LINK_EMAIL,
+	LINK__MAX
+};
+
+static const char *const links[LINK__MAX] = {
+	"halink_url", /* LINK_URL */
+	"halink_www", /* LINK_WWW */
+	"halink_email", /* LINK_EMAIL */
+};
+
+static void
+bench_link(int *first, enum link l, enum input in,
+	struct lowdown_buf *data, size_t iters)
+{
+	size_t			 i, off, calls = 0, found = 0, rewind;
+	uint64_t		 start, ns;
+	size_t			 allocs;
+	const char		 trig[LINK__MAX] = { ':', 'w', '@' };
+
+	allocs = bench_allocs;
+	start = bench_now();
+	for (i = 0; i < iters; i++)
+		for (off = calls = 0; off < data->size; off++) {
+			if (data->data[off] != trig[l])
+				continue;
+			calls++;
+			switch (l) {
+			case LINK_URL:
+				found += halink_url(&rewind,
+					data->data + off, off,
+					data->size - off);
+				break;
+			case LINK_WWW:
+				found += halink_www(&rewind,
+					data->data + off, off,
+					data->size - off);
+				break;
+			case LINK_EMAIL:
+				found += halink_email(&rewind,
+					data->data + off, off,
+					data->size - off);
+				break;
+			default:
+				abort();
+			}
+		}
+	ns = bench_now() - start;
+	allocs = bench_allocs - allocs;
+
+	if (found == SIZE_MAX)
+		putchar('\0');
+
+	result(first, links[l], in, data->size, calls, iters, ns, allocs);
+}
+
+/*
+ * Parse link-free prose with parse features "feat".
+ * With LOWDOWN_AUTOLINK, this shows the cost of the autolink triggers
+ * (mostly 'w') on the parser's hot path; with LOWDOWN_LAZY, that of
+ * scanning only for block structure.
+ * If "events" is set, parse with lowdown_doc_events() and no callbacks
+ * instead of building and freeing the tree.
+ */
+static void
+bench_parse(int *first, const char *name, unsigned int feat, int events,
+	enum input in, const struct lowdown_buf *data, size_t iters)
+{
+	struct lowdown_opts	 opts;
+	struct lowdown_doc	*doc;
+	struct lowdown_node	*n;
+	struct lowdown_events	 ev;
+	size_t			 i, allocs;
+	uint64_t		 start, ns;
+
+	memset(&opts, 0, sizeof(struct lowdown_opts));
+	opts.maxdepth = 128;
+	opts.feat = feat;
+
+	memset(&ev, 0, sizeof(struct lowdown_events));
+
+	if ((doc = lowdown_doc_new(&opts)) == NULL)
+		err(EXIT_FAILURE, NULL);
+
+	allocs = bench_allocs;
+	start = bench_now();
+	for (i = 0; i < iters; i++) {
+		if (events) {
+			lowdown_doc_events(doc, &ev,
+				data->data, data->size);
+			continue;
+		}
+		n = lowdown_doc_parse(doc, NULL, data->data, data->size);
+		lowdown_node_free(n);
+	}
+	ns = bench_now() - start;
+	allocs = bench_allocs - allocs;
+
+	result(first, name, in, data->size, 1, iters, ns, allocs);
+	lowdown_doc_free(doc);
+}
+
+/*
+ * Count the nodes under and including "n" by recursion, as the
+ * renderers do.
+ */
+static size_t
+walk_recursive(const struct lowdown_node *n)
+{
+	const struct lowdown_node	*child;
+	size_t				 nodes = 1;
+
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		nodes += walk_recursive(child);
+	return nodes;
+}
+
+/*
+ * Count the nodes of the parsed input either recursively or with
+ * lowdown_iter_next(), if "iter" is set.
+ * Calls are per node visited.
+ */
+static void
+bench_walk(int *first, int iter, enum input in,
+	const struct lowdown_buf *data, size_t iters)
+{
+	struct lowdown_opts	 opts;
+	struct lowdown_doc	*doc;
+	struct lowdown_node	*root;
+	struct lowdown_iter	 it;
+	size_t			 i, nodes = 0, allocs;
+	uint64_t		 start, ns;
+
+	/* The deep input is well beyond the default depth limit. */
+
+	memset(&opts, 0, sizeof(struct lowdown_opts));
+	opts.maxdepth = 0;
+
+	if ((doc = lowdown_doc_new(&opts)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	root = lowdown_doc_parse(doc, NULL, data->data, data->size);
+
+	allocs = bench_allocs;
+	start = bench_now();
+	for (i = 0; i < iters; i++) {
+		nodes = 0;
+		if (!iter) {
+			nodes = walk_recursive(root);
+			continue;
+		}
+		lowdown_iter_init(&it, root);
+		while (lowdown_iter_next(&it) != LOWDOWN_ITER_DONE)
+			if (it.event == LOWDOWN_ITER_ENTER)
+				nodes++;
+	}
+	ns = bench_now() - start;
+	allocs = bench_allocs - allocs;
+
+	result(first, iter ? "lowdown_iter_next" : "walk_recursive",
+		in, data->size, nodes, iters, ns, allocs);
+	lowdown_node_free(root);
+	lowdown_doc_free(doc);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lowdown_buf	*data[IN__MAX];
+	const char		*er;
+	size_t			 iters = 50;
+	int			 c, first = 1;
+	enum input		 in;
+	enum esc		 e;
+	enum link		 l;
+
+	/* For term_mbswidth(), as in lowdown(1). */
+
+	setlocale(LC_CTYPE, "");
+
+	while ((c = getopt(argc, argv, "n:")) != -1)
+		switch (c) {
+		case 'n':
+			iters = strtonum(optarg, 1, INT_MAX, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-n: %s", er);
+			break;
+		default:
+			goto usage;
+		}
+
+	if (argc != optind)
+		goto usage;
+
+	for (in = 0; in < IN__MAX; in++) {
+		data[in] = hbuf_new(INSZ + 64);
+		gen_input(data[in], in);
+	}
+
+	printf("{\"iterations\": %zu, \"results\": [\n", iters);
+
+	for (e = 0; e < ESC__MAX; e++)
+		for (in = IN_ASCII; in <= IN_RANDOM; in++)
+			bench_esc(&first, e, in, data[in], iters);
+
+	for (in = IN_ENT_NAMED; in <= IN_ENT_BAD; in++) {
+		bench_ent(&first, 0, in, data[in], iters);
+		bench_ent(&first, 1, in, data[in], iters);
+	}
+
+	for (l = 0; l < LINK__MAX; l++) {
+		bench_link(&first, l, IN_LINKS, data[IN_LINKS], iters);
+		bench_link(&first, l, IN_TRIGGERS, data[IN_TRIGGERS], iters);
+		bench_link(&first, l, IN_RANDOM, data[IN_RANDOM], iters);
+	}
+
+	bench_parse(&first, "lowdown_doc_parse",
+		0, 0, IN_ASCII, data[IN_ASCII], iters);
+	bench_parse(&first, "lowdown_doc_parse+autolink",
+		LOWDOWN_AUTOLINK, 0, IN_ASCII, data[IN_ASCII], iters);
+	bench_parse(&first, "lowdown_doc_parse+lazy",
+		LOWDOWN_LAZY, 0, IN_ASCII, data[IN_ASCII], iters);
+	bench_parse(&first, "lowdown_doc_events",
+		0, 1, IN_ASCII, data[IN_ASCII], iters);
+
+	bench_walk(&first, 0, IN_DEEP, data[IN_DEEP], iters * 100);
+	bench_walk(&first, 1, IN_DEEP, data[IN_DEEP], iters * 100);
+
+	puts("\n]}");
+
+	for (in = 0; in < IN__MAX; in++)
+		hbuf_free(data[in]);
+	return EXIT_SUCCESS;
+usage:
+	fprintf(stderr, "usage: %s [-n iterations]\n", getprogname());
+	return EXIT_FAILURE;
+}
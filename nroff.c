@@ -119,7 +119,7 @@ static const enum nscope nscopes[LOWDOWN__MAX] = {
  * Otherwise, a leading period will be escaped.
  * If "oneline" is non-zero, newlines are replaced with spaces.
  */
-static void
+void
 hesc_nroff(struct lowdown_buf *ob, const char *data, 
 	size_t size, int span, int oneline, int keep)
 {
@@ -388,9 +388,11 @@ putlink(struct lowdown_buf *ob, struct nroff *st,
 			HBUF_PUTSL(ob, "mailto:");
 		for (i = 0; i < link->size; i++) {
 			if (!isprint((unsigned char)link->data[i]) ||
-			    strchr("<>\\^`{|}\"", link->data[i]) != NULL)
-				hbuf_printf(ob, "%%%.2X", link->data[i]);
-			else
+			    strchr("<>\\^`{|}\"", link->data[i]) != NULL) {
+				hbuf_putc(ob, '%');
+				hbuf_putx(ob,
+					(unsigned char)link->data[i], 2);
+			} else
 				hbuf_putc(ob, link->data[i]);
 		}
 		HBUF_PUTSL(ob, " ");
@@ -618,12 +620,16 @@ rndr_header(struct lowdown_buf *ob,
 		return;
 	} 
 
-	if (st->flags & LOWDOWN_NROFF_NUMBERED)
-		hbuf_printf(ob, ".NH %zu\n", level);
-	else if (st->flags & LOWDOWN_NROFF_GROFF)
-		hbuf_printf(ob, ".SH %zu\n", level);
-	else
-		hbuf_printf(ob, ".SH\n");
+	if (st->flags & LOWDOWN_NROFF_NUMBERED) {
+		HBUF_PUTSL(ob, ".NH ");
+		hbuf_putu(ob, level);
+		hbuf_putc(ob, '\n');
+	} else if (st->flags & LOWDOWN_NROFF_GROFF) {
+		HBUF_PUTSL(ob, ".SH ");
+		hbuf_putu(ob, level);
+		hbuf_putc(ob, '\n');
+	} else
+		HBUF_PUTSL(ob, ".SH\n");
 
 	/* Used in -mspdf output for creating a TOC. */
 
@@ -676,9 +682,11 @@ rndr_listitem(struct lowdown_buf *ob,
 	if (content->size == 0)
 		return;
 
-	if (p->flags & HLIST_FL_ORDERED)
-		hbuf_printf(ob, ".IP \"%zu.  \"\n", p->num);
-	else if (p->flags & HLIST_FL_UNORDERED)
+	if (p->flags & HLIST_FL_ORDERED) {
+		HBUF_PUTSL(ob, ".IP \"");
+		hbuf_putu(ob, p->num);
+		HBUF_PUTSL(ob, ".  \"\n");
+	} else if (p->flags & HLIST_FL_UNORDERED)
 		HBUF_PUTSL(ob,  ".IP \"\\(bu\" 2\n");
 
 	/* Strip out all leading redundant paragraphs. */
@@ -1087,7 +1095,9 @@ rndr_footnote_def(struct lowdown_buf *ob,
 	 */
 
 	HBUF_PUTSL(ob, ".LP\n");
-	hbuf_printf(ob, "\\0\\fI\\u\\s-3%zu\\s+3\\d\\fP\\0", num);
+	HBUF_PUTSL(ob, "\\0\\fI\\u\\s-3");
+	hbuf_putu(ob, num);
+	HBUF_PUTSL(ob, "\\s+3\\d\\fP\\0");
 	if (content->size > 3 &&
 	    (memcmp(content->data, ".PP\n", 4) == 0 ||
 	     memcmp(content->data, ".LP\n", 4) == 0))
@@ -1109,8 +1119,11 @@ rndr_footnote_ref(struct lowdown_buf *ob,
 
 	if (!st->man)
 		HBUF_PUTSL(ob, "\\**");
-	else
-		hbuf_printf(ob, "\\u\\s-3%zu\\s+3\\d", num);
+	else {
+		HBUF_PUTSL(ob, "\\u\\s-3");
+		hbuf_putu(ob, num);
+		HBUF_PUTSL(ob, "\\s+3\\d");
+	}
 }
 
 /*
@@ -1263,7 +1276,7 @@ static void
 rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq, 
 	struct nroff *st, struct lowdown_node *n)
 {
-	struct lowdown_node	*child, *next, *prev;
+	struct lowdown_node	*child, *next, *prev, *row;
 	struct lowdown_buf	*tmp;
 	int			 pnln, keepnext = 1;
 	int32_t			 ent;
@@ -1304,8 +1317,12 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		break;
 	}
 
-	TAILQ_FOREACH(child, &n->children, entries)
-		rndr(tmp, mq, st, child);
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		if ((row = table_row_expand(child)) != NULL) {
+			rndr(tmp, mq, st, row);
+			lowdown_node_free(row);
+		} else
+			rndr(tmp, mq, st, child);
 
 	/* 
 	 * Compute whether the previous output does have a newline:
@@ -1451,10 +1468,11 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		break;
 	case LOWDOWN_ENTITY:
 		ent = entity_find_iso(&n->rndr_entity.text);
-		if (ent > 0)
-			hbuf_printf(ob, "\\[u%.4llX]", 
-				(unsigned long long)ent);
-		else
+		if (ent > 0) {
+			HBUF_PUTSL(ob, "\\[u");
+			hbuf_putx(ob, ent, 4);
+			hbuf_putc(ob, ']');
+		} else
 			hbuf_putb(ob, &n->rndr_entity.text);
 		break;
 	default:
@@ -1518,7 +1536,9 @@ lowdown_nroff_rndr(struct lowdown_buf *ob,
 	memset(st->fonts, 0, sizeof(st->fonts));
 	st->base_header_level = 1;
 	st->post_para = 0;
+	LOWDOWN_PROBE2(render__start, "nroff", n->id);
 	rndr(ob, mq, st, n);
+	LOWDOWN_PROBE2(render__done, "nroff", ob->size);
 
 	/* Release temporary metaq. */
 
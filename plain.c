@@ -0,0 +1,461 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lowdown.h"
+#include "extern.h"
+
+/*
+ * Plain-text output: only the visible text of the document, with
+ * header anchors and link targets, for indexing and the like.
+ * Nothing is escaped, styled, or wrapped.
+ * With LOWDOWN_PLAIN_JSON, text is instead collected per section (the
+ * content following each header) and emitted as one JSON object per
+ * line.
+ */
+struct plain {
+	unsigned int		 flags; /* "oflags" in lowdown_opts */
+	void			*html; /* for header identifiers */
+	struct lowdown_buf	*out; /* output buffer */
+	struct lowdown_buf	*text; /* current text output */
+	struct lowdown_buf	*sect; /* section text (json) */
+	struct lowdown_buf	*title; /* section title (json) */
+	struct lowdown_buf	*id; /* section or header anchor */
+	struct lowdown_buf	*links; /* section links (json) */
+	size_t			 level; /* section level (json) */
+	struct lowdown_buf	*tmp; /* for identifiers */
+};
+
+static void rndr(struct plain *, struct lowdown_metaq *,
+	const struct lowdown_node *);
+
+/*
+ * Make sure that the output ends with "nl" newlines (at most two),
+ * unless it's empty.
+ */
+static void
+rndr_vspace(struct lowdown_buf *ob, size_t nl)
+{
+	size_t	 have;
+
+	if (ob->size == 0)
+		return;
+	for (have = 0; have < nl && have < ob->size; have++)
+		if (ob->data[ob->size - have - 1] != '\n')
+			break;
+	for ( ; have < nl; have++)
+		hbuf_putc(ob, '\n');
+}
+
+/*
+ * Write "sz" bytes of "data" as the contents of a JSON string.
+ * Bytes outside of ASCII are passed through as-is.
+ */
+static void
+rndr_json(struct lowdown_buf *ob, const char *data, size_t sz)
+{
+	size_t	 i, start;
+
+	for (i = start = 0; i < sz; i++) {
+		if ((unsigned char)data[i] >= 0x20 &&
+		    data[i] != '"' && data[i] != '\\')
+			continue;
+		hbuf_put(ob, data + start, i - start);
+		start = i + 1;
+		switch (data[i]) {
+		case '"':
+			HBUF_PUTSL(ob, "\\\"");
+			break;
+		case '\\':
+			HBUF_PUTSL(ob, "\\\\");
+			break;
+		case '\n':
+			HBUF_PUTSL(ob, "\\n");
+			break;
+		case '\t':
+			HBUF_PUTSL(ob, "\\t");
+			break;
+		default:
+			hbuf_printf(ob, "\\u%.4x",
+				(unsigned char)data[i]);
+			break;
+		}
+	}
+	hbuf_put(ob, data + start, i - start);
+}
+
+/*
+ * Emit the current section as a JSON object, unless it's the content
+ * before the first header and is empty, then reset it.
+ * Trailing newlines of the section text are trimmed.
+ */
+static void
+rndr_section(struct plain *p)
+{
+	struct lowdown_buf	*ob = p->out;
+	size_t			 sz;
+
+	sz = p->sect->size;
+	while (sz > 0 && p->sect->data[sz - 1] == '\n')
+		sz--;
+
+	if (p->level > 0 || sz > 0 || p->links->size > 0) {
+		HBUF_PUTSL(ob, "{\"id\":\"");
+		rndr_json(ob, p->id->data, p->id->size);
+		hbuf_printf(ob, "\",\"level\":%zu,\"title\":\"",
+			p->level);
+		rndr_json(ob, p->title->data, p->title->size);
+		HBUF_PUTSL(ob, "\",\"text\":\"");
+		rndr_json(ob, p->sect->data, sz);
+		HBUF_PUTSL(ob, "\",\"links\":[");
+		hbuf_putb(ob, p->links);
+		HBUF_PUTSL(ob, "]}\n");
+	}
+
+	hbuf_truncate(p->sect);
+	hbuf_truncate(p->title);
+	hbuf_truncate(p->id);
+	hbuf_truncate(p->links);
+}
+
+/*
+ * Record the link target "link": appended to the section's links with
+ * LOWDOWN_PLAIN_JSON, otherwise shown in angle brackets.
+ */
+static void
+rndr_target(struct plain *p, const struct lowdown_buf *link)
+{
+
+	if (link->size == 0)
+		return;
+	if (p->flags & LOWDOWN_PLAIN_JSON) {
+		if (p->links->size)
+			hbuf_putc(p->links, ',');
+		hbuf_putc(p->links, '"');
+		rndr_json(p->links, link->data, link->size);
+		hbuf_putc(p->links, '"');
+		return;
+	}
+	if (p->text->size &&
+	    p->text->data[p->text->size - 1] != '\n')
+		hbuf_putc(p->text, ' ');
+	hbuf_putc(p->text, '<');
+	hbuf_putb(p->text, link);
+	hbuf_putc(p->text, '>');
+}
+
+/*
+ * Put the identifier that -Thtml gives header "n" into "ob".
+ * These are URL-escaped, then HTML-escaped, for use in an attribute:
+ * undo the latter so that they're usable as URL fragments.
+ * This must be called for every header in order, even those not shown,
+ * to keep identifiers in sync with -Thtml.
+ */
+static void
+rndr_header_id(struct lowdown_buf *ob, struct plain *p,
+	const struct lowdown_node *n)
+{
+	size_t	 i;
+
+	hbuf_truncate(ob);
+	hbuf_truncate(p->tmp);
+	html_header_id(p->tmp, p->html, n);
+	for (i = 0; i < p->tmp->size; i++) {
+		if (p->tmp->data[i] != '&') {
+			hbuf_putc(ob, p->tmp->data[i]);
+			continue;
+		}
+		if (p->tmp->size - i >= 5 &&
+		    memcmp(&p->tmp->data[i], "&amp;", 5) == 0) {
+			hbuf_putc(ob, '&');
+			i += 4;
+		} else if (p->tmp->size - i >= 6 &&
+		    memcmp(&p->tmp->data[i], "&#x27;", 6) == 0) {
+			hbuf_putc(ob, '\'');
+			i += 5;
+		} else
+			hbuf_putc(ob, '&');
+	}
+}
+
+/*
+ * Render the children of "n" into "ob" instead of the current output.
+ */
+static void
+rndr_children(struct lowdown_buf *ob, struct plain *p,
+	struct lowdown_metaq *mq, const struct lowdown_node *n)
+{
+	struct lowdown_buf		*text = p->text;
+	const struct lowdown_node	*child;
+
+	p->text = ob;
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		rndr(p, mq, child);
+	p->text = text;
+}
+
+/*
+ * With LOWDOWN_PLAIN_JSON, a header starts a new section.
+ * Otherwise, it's shown on its own line followed by its anchor.
+ */
+static void
+rndr_header(struct plain *p, struct lowdown_metaq *mq,
+	const struct lowdown_node *n)
+{
+
+	if (p->flags & LOWDOWN_PLAIN_JSON) {
+		rndr_section(p);
+		p->level = n->rndr_header.level + 1;
+		rndr_header_id(p->id, p, n);
+		rndr_children(p->title, p, mq, n);
+		return;
+	}
+
+	rndr_vspace(p->text, 2);
+	rndr_children(p->text, p, mq, n);
+	rndr_header_id(p->id, p, n);
+	if (p->id->size) {
+		HBUF_PUTSL(p->text, " <#");
+		hbuf_putb(p->text, p->id);
+		hbuf_putc(p->text, '>');
+	}
+	rndr_vspace(p->text, 2);
+}
+
+/*
+ * Render the children of metadata into "mq", if it exists, but never
+ * into the output.
+ */
+static void
+rndr_meta(struct plain *p, struct lowdown_metaq *mq,
+	const struct lowdown_node *n)
+{
+	struct lowdown_buf	*tmp;
+	struct lowdown_meta	*m;
+
+	if (mq == NULL)
+		return;
+
+	tmp = hbuf_new(128);
+	m = xcalloc(1, sizeof(struct lowdown_meta));
+	TAILQ_INSERT_TAIL(mq, m, entries);
+	m->key = xstrndup(n->rndr_meta.key.data,
+		n->rndr_meta.key.size);
+	rndr_children(tmp, p, mq, n);
+	m->value = xstrndup(tmp->data, tmp->size);
+	hbuf_free(tmp);
+}
+
+static void
+rndr(struct plain *p, struct lowdown_metaq *mq,
+	const struct lowdown_node *n)
+{
+	const struct lowdown_node	*child;
+	struct lowdown_node		*row;
+	struct lowdown_buf		*ob = p->text;
+	int32_t				 entity;
+
+	/* Leading content and nodes without (visible) children. */
+
+	switch (n->type) {
+	case LOWDOWN_BLOCKCODE:
+		rndr_vspace(ob, 2);
+		hbuf_putb(ob, &n->rndr_blockcode.text);
+		rndr_vspace(ob, 2);
+		return;
+	case LOWDOWN_BLOCKHTML:
+	case LOWDOWN_FOOTNOTE_REF:
+	case LOWDOWN_RAW_HTML:
+		return;
+	case LOWDOWN_CODESPAN:
+		hbuf_putb(ob, &n->rndr_codespan.text);
+		return;
+	case LOWDOWN_ENTITY:
+		entity = entity_find_iso(&n->rndr_entity.text);
+		if (entity > 0)
+			entity_utf8(ob, entity);
+		else
+			hbuf_putb(ob, &n->rndr_entity.text);
+		return;
+	case LOWDOWN_HEADER:
+		rndr_header(p, mq, n);
+		return;
+	case LOWDOWN_IMAGE:
+		hbuf_putb(ob, &n->rndr_image.alt);
+		rndr_target(p, &n->rndr_image.link);
+		return;
+	case LOWDOWN_LINEBREAK:
+		hbuf_putc(ob, '\n');
+		return;
+	case LOWDOWN_LINK_AUTO:
+		hbuf_putb(ob, &n->rndr_autolink.text);
+		if (p->flags & LOWDOWN_PLAIN_JSON)
+			rndr_target(p, &n->rndr_autolink.link);
+		return;
+	case LOWDOWN_MATH_BLOCK:
+		if (n->rndr_math.blockmode)
+			rndr_vspace(ob, 2);
+		hbuf_putb(ob, &n->rndr_math.text);
+		if (n->rndr_math.blockmode)
+			rndr_vspace(ob, 2);
+		return;
+	case LOWDOWN_META:
+		rndr_meta(p, mq, n);
+		return;
+	case LOWDOWN_NORMAL_TEXT:
+		hbuf_putb(ob, &n->rndr_normal_text.text);
+		return;
+	case LOWDOWN_LIST:
+		if (n->parent != NULL &&
+		    n->parent->type == LOWDOWN_LISTITEM) {
+			rndr_vspace(ob, 1);
+			break;
+		}
+		/* FALLTHROUGH */
+	case LOWDOWN_BLOCKQUOTE:
+	case LOWDOWN_DEFINITION:
+	case LOWDOWN_FOOTNOTES_BLOCK:
+	case LOWDOWN_HRULE:
+	case LOWDOWN_PARAGRAPH:
+	case LOWDOWN_TABLE_BLOCK:
+		rndr_vspace(ob, 2);
+		break;
+	case LOWDOWN_DEFINITION_DATA:
+	case LOWDOWN_DEFINITION_TITLE:
+	case LOWDOWN_FOOTNOTE_DEF:
+	case LOWDOWN_LISTITEM:
+	case LOWDOWN_TABLE_ROW:
+		rndr_vspace(ob, 1);
+		break;
+	case LOWDOWN_TABLE_CELL:
+		if (n->rndr_table_cell.col > 0)
+			hbuf_putc(ob, '\t');
+		break;
+	default:
+		break;
+	}
+
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries)
+		if ((row = table_row_expand(child)) != NULL) {
+			rndr(p, mq, row);
+			lowdown_node_free(row);
+		} else
+			rndr(p, mq, child);
+
+	/* Trailing content. */
+
+	switch (n->type) {
+	case LOWDOWN_LINK:
+		rndr_target(p, &n->rndr_link.link);
+		break;
+	case LOWDOWN_LIST:
+		if (n->parent != NULL &&
+		    n->parent->type == LOWDOWN_LISTITEM) {
+			rndr_vspace(p->text, 1);
+			break;
+		}
+		/* FALLTHROUGH */
+	case LOWDOWN_BLOCKQUOTE:
+	case LOWDOWN_DEFINITION:
+	case LOWDOWN_FOOTNOTES_BLOCK:
+	case LOWDOWN_PARAGRAPH:
+	case LOWDOWN_TABLE_BLOCK:
+		rndr_vspace(p->text, 2);
+		break;
+	case LOWDOWN_DEFINITION_DATA:
+	case LOWDOWN_DEFINITION_TITLE:
+	case LOWDOWN_FOOTNOTE_DEF:
+	case LOWDOWN_LISTITEM:
+	case LOWDOWN_TABLE_ROW:
+		rndr_vspace(p->text, 1);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+lowdown_plain_rndr(struct lowdown_buf *ob,
+	struct lowdown_metaq *mq, void *arg,
+	const struct lowdown_node *n)
+{
+	struct plain	*p = arg;
+	size_t		 sz;
+
+	LOWDOWN_PROBE2(render__start, "plain", n->id);
+
+	p->out = ob;
+	html_reset(p->html);
+	if (p->flags & LOWDOWN_PLAIN_JSON) {
+		p->text = p->sect;
+		p->level = 0;
+		rndr(p, mq, n);
+		rndr_section(p);
+	} else {
+		sz = ob->size;
+		p->text = ob;
+		rndr(p, mq, n);
+		while (ob->size > sz + 1 &&
+		       ob->data[ob->size - 2] == '\n')
+			ob->size--;
+	}
+
+	p->text = p->out = NULL;
+	LOWDOWN_PROBE2(render__done, "plain", ob->size);
+}
+
+void *
+lowdown_plain_new(const struct lowdown_opts *opts)
+{
+	struct plain	*p;
+
+	p = xcalloc(1, sizeof(struct plain));
+	p->flags = opts == NULL ? 0 : opts->oflags;
+	p->html = lowdown_html_new(opts);
+	p->sect = hbuf_new(1024);
+	p->title = hbuf_new(64);
+	p->id = hbuf_new(64);
+	p->links = hbuf_new(64);
+	p->tmp = hbuf_new(64);
+	return p;
+}
+
+void
+lowdown_plain_free(void *arg)
+{
+	struct plain	*p = arg;
+
+	if (p == NULL)
+		return;
+
+	lowdown_html_free(p->html);
+	hbuf_free(p->sect);
+	hbuf_free(p->title);
+	hbuf_free(p->id);
+	hbuf_free(p->links);
+	hbuf_free(p->tmp);
+	free(p);
+}
@@ -0,0 +1,374 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2020 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lowdown.h"
+#include "extern.h"
+#include "bench.h"
+
+/*
+ * Scaling suite for pathological inputs.
+ * Each family generates an input from a unit count; the input is run
+ * through lowdown_buf() at sizes n, 2n, 4n, and 8n.
+ * If runtime or allocations grow, per doubling of the input, by more
+ * than a given factor (i.e., super-linearly), the family fails.
+ * Timings are the fastest of several repeats, and a family is only
+ * reported as failing if it does so on each of several tries, so a
+ * noisy machine doesn't fail a linear family.
+ */
+
+typedef void (*genfp)(struct lowdown_buf *, size_t);
+
+static void gen_brackets(struct lowdown_buf *, size_t);
+static void gen_codespan(struct lowdown_buf *, size_t);
+static void gen_emails(struct lowdown_buf *, size_t);
+static void gen_emph(struct lowdown_buf *, size_t);
+static void gen_html(struct lowdown_buf *, size_t);
+static void gen_links(struct lowdown_buf *, size_t);
+static void gen_lists(struct lowdown_buf *, size_t);
+static void gen_lt(struct lowdown_buf *, size_t);
+static void gen_quotes(struct lowdown_buf *, size_t);
+static void gen_refs(struct lowdown_buf *, size_t);
+static void gen_urls(struct lowdown_buf *, size_t);
+
+static const struct family {
+	const char	*name;
+	genfp		 gen;
+} families[] = {
+	{ "emph", gen_emph },
+	{ "codespan", gen_codespan },
+	{ "brackets", gen_brackets },
+	{ "links", gen_links },
+	{ "refs", gen_refs },
+	{ "lt", gen_lt },
+	{ "html", gen_html },
+	{ "quotes", gen_quotes },
+	{ "lists", gen_lists },
+	{ "emails", gen_emails },
+	{ "urls", gen_urls },
+	{ NULL, NULL }
+};
+
+#define	SIZES	4 /* n, 2n, 4n, 8n */
+
+/*
+ * Unclosed emphasis of all kinds on a single line.
+ */
+static void
+gen_emph(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		HBUF_PUTSL(ob, "*a _b **c __d ~~e ==f ");
+	HBUF_PUTSL(ob, "\n");
+}
+
+/*
+ * Unclosed code spans of increasing backtick runs.
+ */
+static void
+gen_codespan(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		hbuf_printf(ob, "%.*s a ", (int)(1 + i % 4), "````");
+	HBUF_PUTSL(ob, "\n");
+}
+
+/*
+ * Unclosed, nested link text brackets.
+ */
+static void
+gen_brackets(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		HBUF_PUTSL(ob, "[a ");
+	HBUF_PUTSL(ob, "\n");
+}
+
+/*
+ * Links whose destination is never closed.
+ */
+static void
+gen_links(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		HBUF_PUTSL(ob, "[a](b ");
+	HBUF_PUTSL(ob, "\n");
+}
+
+/*
+ * Many reference definitions, each used once.
+ */
+static void
+gen_refs(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		hbuf_printf(ob, "[r%zu] ", i);
+	HBUF_PUTSL(ob, "\n\n");
+	for (i = 0; i < n; i++)
+		hbuf_printf(ob, "[r%zu]: /u%zu\n", i, i);
+}
+
+/*
+ * Long runs of tag openers that never close, for tag_length().
+ */
+static void
+gen_lt(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		HBUF_PUTSL(ob, "< <a <a:b <a b=");
+	HBUF_PUTSL(ob, "\n");
+}
+
+/*
+ * Block-level HTML openers that are never closed.
+ */
+static void
+gen_html(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		HBUF_PUTSL(ob, "<div>\ntext\n\n");
+}
+
+/*
+ * Blockquotes nesting up and down again.
+ * The depth is capped to stay within the default maximum parse depth.
+ */
+static void
+gen_quotes(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		hbuf_printf(ob, "%.*s a\n",
+			(int)(1 + i % 32),
+			">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>");
+}
+
+/*
+ * List items nesting up and down again.
+ */
+static void
+gen_lists(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		hbuf_printf(ob, "%*s- a\n", (int)(2 * (i % 16)), "");
+}
+
+/*
+ * A single unbroken token with an e-mail trigger every few bytes, like
+ * a log line or encoded blob within a paragraph.
+ */
+static void
+gen_emails(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	HBUF_PUTSL(ob, "x ");
+	for (i = 0; i < n; i++)
+		HBUF_PUTSL(ob, "a.b@c-d.e");
+	HBUF_PUTSL(ob, "\n");
+}
+
+/*
+ * A single unbroken token with URL triggers every few bytes.
+ */
+static void
+gen_urls(struct lowdown_buf *ob, size_t n)
+{
+	size_t	 i;
+
+	HBUF_PUTSL(ob, "x ");
+	for (i = 0; i < n; i++)
+		HBUF_PUTSL(ob, "ab://:c");
+	HBUF_PUTSL(ob, "\n");
+}
+
+/*
+ * Run the family "f" at base size "n".
+ * Returns zero on super-linear growth, non-zero otherwise.
+ */
+static int
+run_family(const struct lowdown_opts *opts, const struct family *f,
+	size_t n, size_t reps, double tfactor, double afactor)
+{
+	struct lowdown_buf	*in;
+	uint64_t		 t[SIZES], a[SIZES], start, el;
+	size_t			 i, j, units, retsz;
+	char			*ret;
+	double			 tgrowth, agrowth;
+	int			 rc;
+
+	for (i = 0; i < SIZES; i++) {
+		units = n << i;
+		in = hbuf_new(units * 16);
+		f->gen(in, units);
+
+		/* Take the fastest run to reduce noise. */
+
+		t[i] = UINT64_MAX;
+		for (j = 0; j < reps; j++) {
+			a[i] = bench_allocs;
+			start = bench_now();
+			lowdown_buf(opts, in->data,
+				in->size, &ret, &retsz, NULL);
+			el = bench_now() - start;
+			a[i] = bench_allocs - a[i];
+			if (el < t[i])
+				t[i] = el;
+			free(ret);
+		}
+		hbuf_free(in);
+	}
+
+	/* Mean growth per doubling of the input. */
+
+	tgrowth = pow((double)t[SIZES - 1] /
+		(t[0] > 0 ? t[0] : 1), 1.0 / (SIZES - 1));
+	agrowth = pow((double)a[SIZES - 1] /
+		(a[0] > 0 ? a[0] : 1), 1.0 / (SIZES - 1));
+	rc = tgrowth <= tfactor && agrowth <= afactor;
+
+	printf("%-10s", f->name);
+	for (i = 0; i < SIZES; i++)
+		printf(" %8.3fms", t[i] / 1e6);
+	printf("  time x%.2f  allocs x%.2f  %s\n",
+		tgrowth, agrowth, rc ? "ok" : "FAIL");
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct lowdown_opts	 opts;
+	const char		*er;
+	size_t			 i, k, n = 500, reps = 9, tries = 3;
+	double			 tfactor = 3.0, afactor = 2.5;
+	int			 c, j, rc = 1;
+	char			*ep;
+
+	while ((c = getopt(argc, argv, "a:f:n:r:t:")) != -1)
+		switch (c) {
+		case 'a':
+			afactor = strtod(optarg, &ep);
+			if (*ep != '\0' || afactor <= 1.0)
+				errx(EXIT_FAILURE, "-a: invalid");
+			break;
+		case 'f':
+			tfactor = strtod(optarg, &ep);
+			if (*ep != '\0' || tfactor <= 1.0)
+				errx(EXIT_FAILURE, "-f: invalid");
+			break;
+		case 'n':
+			n = strtonum(optarg, 1, INT_MAX / 256, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-n: %s", er);
+			break;
+		case 'r':
+			reps = strtonum(optarg, 1, INT_MAX, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-r: %s", er);
+			break;
+		case 't':
+			tries = strtonum(optarg, 1, INT_MAX, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-t: %s", er);
+			break;
+		default:
+			goto usage;
+		}
+
+	argc -= optind;
+	argv += optind;
+
+	/* Same defaults as the lowdown(1) utility. */
+
+	memset(&opts, 0, sizeof(struct lowdown_opts));
+	opts.type = LOWDOWN_HTML;
+	opts.maxdepth = 128;
+	opts.feat = LOWDOWN_FOOTNOTES |
+		LOWDOWN_AUTOLINK |
+		LOWDOWN_TABLES |
+		LOWDOWN_SUPER |
+		LOWDOWN_STRIKE |
+		LOWDOWN_FENCED |
+		LOWDOWN_COMMONMARK |
+		LOWDOWN_DEFLIST |
+		LOWDOWN_IMG_EXT |
+		LOWDOWN_METADATA;
+	opts.oflags =
+		LOWDOWN_HTML_ESCAPE |
+		LOWDOWN_HTML_HEAD_IDS |
+		LOWDOWN_HTML_NUM_ENT |
+		LOWDOWN_HTML_OWASP |
+		LOWDOWN_HTML_SKIP_HTML |
+		LOWDOWN_SMARTY;
+
+	for (i = 0; families[i].name != NULL; i++) {
+		for (j = 0; j < argc; j++)
+			if (strcmp(argv[j], families[i].name) == 0)
+				break;
+		if (argc > 0 && j == argc)
+			continue;
+		for (k = 0; k < tries; k++) {
+			c = run_family(&opts, &families[i],
+				n, reps, tfactor, afactor);
+			fflush(stdout);
+			if (c)
+				break;
+		}
+		if (k == tries)
+			rc = 0;
+	}
+
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+usage:
+	fprintf(stderr, "usage: %s [-a allocfactor] [-f timefactor] "
+		"[-n units] [-r repeats] [-t tries] [family ...]\n",
+		getprogname());
+	return EXIT_FAILURE;
+}
@@ -407,9 +407,12 @@ smarty_span(struct lowdown_node *root, size_t *maxn, struct smarty *s)
 	}
 }
 
+/*
+ * Apply smartypants to the inline content of block "root" and, if
+ * "recurse" is set, to that of its child blocks.
+ */
 static void
-smarty_block(struct lowdown_node *root,
-	size_t *maxn, enum lowdown_type type)
+smarty_block(struct lowdown_node *root, size_t *maxn, int recurse)
 {
 	struct smarty		 s;
 	struct lowdown_node	*n;
@@ -420,8 +423,13 @@ smarty_block(struct lowdown_node *root,
 		switch (types[n->type]) {
 		case TYPE_ROOT:
 		case TYPE_BLOCK:
+			/*
+			 * Content not yet parsed (LOWDOWN_LAZY) gets
+			 * smartypants when it's parsed.
+			 */
 			s.left_wb = 1;
-			smarty_block(n, maxn, type);
+			if (recurse && !lazy_unparsed(n))
+				smarty_block(n, maxn, 1);
 			break;
 		case TYPE_TEXT:
 			assert(n->type == LOWDOWN_NORMAL_TEXT);
@@ -439,8 +447,22 @@ smarty_block(struct lowdown_node *root,
 			break;
 		}
 	}
+}
 
-	s.left_wb = 1;
+/*
+ * Apply smartypants to the inline content of "root", if a block, but
+ * not to that of its child blocks, which must be passed separately.
+ * Returns non-zero if "root" is a block, so may have child blocks.
+ */
+int
+smarty_node(struct lowdown_node *root, size_t *maxn)
+{
+
+	if (types[root->type] != TYPE_ROOT &&
+	    types[root->type] != TYPE_BLOCK)
+		return 0;
+	smarty_block(root, maxn, 0);
+	return 1;
 }
 
 void
@@ -450,6 +472,9 @@ smarty(struct lowdown_node *n,
 
 	if (n == NULL)
 		return;
-	assert(types[n->type] == TYPE_ROOT);
-	smarty_block(n, &maxn, type);
+	assert(types[n->type] == TYPE_ROOT ||
+	    types[n->type] == TYPE_BLOCK);
+	LOWDOWN_PROBE1(smarty__start, maxn);
+	smarty_block(n, &maxn, 1);
+	LOWDOWN_PROBE1(smarty__done, maxn);
 }
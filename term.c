@@ -168,8 +168,8 @@ rndr(struct lowdown_buf *, struct lowdown_metaq *,
  * Get the column width of a multi-byte sequence.
  * If the sequence is bad, return the number of raw bytes to print.
  */
-static size_t
-rndr_mbswidth(struct term *term, const char *buf, size_t sz)
+size_t
+term_mbswidth(struct term *term, const char *buf, size_t sz)
 {
 	size_t	 	 wsz, csz;
 	const char	*cp;
@@ -205,7 +205,7 @@ rndr_escape(struct term *term, struct lowdown_buf *out,
 
 	for (i = 0; i < sz; i++)
 		if (iscntrl((unsigned char)buf[i])) {
-			cols += rndr_mbswidth
+			cols += term_mbswidth
 				(term, buf + start, i - start);
 			hbuf_put(out, buf + start, i - start);
 			start = i + 1;
@@ -214,7 +214,7 @@ rndr_escape(struct term *term, struct lowdown_buf *out,
 	/* Remaining bytes. */
 
 	if (start < sz) {
-		cols += rndr_mbswidth(term, buf + start, sz - start);
+		cols += term_mbswidth(term, buf + start, sz - start);
 		hbuf_put(out, buf + start, sz - start);
 	}
 
@@ -295,6 +295,20 @@ rndr_short_link(struct lowdown_buf *out,
 	hbuf_put(out, rcp, sz - (rcp - link->data));
 }
 
+/*
+ * Output the list or footnote number "num" as a prefix, right-aligned
+ * in two columns.
+ */
+static void
+rndr_num(struct lowdown_buf *out, size_t num)
+{
+
+	if (num < 10)
+		hbuf_putc(out, ' ');
+	hbuf_putu(out, num);
+	HBUF_PUTSL(out, ". ");
+}
+
 /*
  * Output style "s" into "out" as an ANSI escape.
  * If "s" does not have any style information, output nothing.
@@ -330,12 +344,12 @@ rndr_buf_style(struct lowdown_buf *out, const struct sty *s)
 	if (s->bcolour) {
 		if (has++)
 			HBUF_PUTSL(out, ";");
-		hbuf_printf(out, "%zu", s->bcolour);
+		hbuf_putu(out, s->bcolour);
 	}
 	if (s->colour) {
 		if (has++)
 			HBUF_PUTSL(out, ";");
-		hbuf_printf(out, "%zu", s->colour);
+		hbuf_putu(out, s->colour);
 	}
 	HBUF_PUTSL(out, "m");
 }
@@ -587,8 +601,7 @@ rndr_buf_startline_prefixes(struct term *term,
 		rndr_buf_style(out, &sinner);
 		pstyle = 1;
 		if (emit == 0)
-			hbuf_printf(out, "%2zu. ", 
-				n->rndr_footnote_def.num);
+			rndr_num(out, n->rndr_footnote_def.num);
 		else
 			HBUF_PUTSL(out, "    ");
 		rndr_buf_advance(term, 4);
@@ -623,8 +636,7 @@ rndr_buf_startline_prefixes(struct term *term,
 			break;
 		}
 		if (emit == 0)
-			hbuf_printf(out, "%2zu. ", 
-				n->rndr_listitem.num);
+			rndr_num(out, n->rndr_listitem.num);
 		else
 			HBUF_PUTSL(out, "    ");
 		rndr_buf_advance(term, 4);
@@ -809,42 +821,6 @@ rndr_buf(struct term *term, struct lowdown_buf *out,
 	}
 }
 
-/*
- * Output the unicode entry "val", which must be strictly greater than
- * zero, as a UTF-8 sequence.
- * This does no error checking.
- */
-static void
-rndr_entity(struct lowdown_buf *buf, int32_t val)
-{
-
-	assert(val > 0);
-	if (val < 0x80) {
-		hbuf_putc(buf, val);
-		return;
-	}
-       	if (val < 0x800) {
-		hbuf_putc(buf, 192 + val / 64);
-		hbuf_putc(buf, 128 + val % 64);
-		return;
-	}
-       	if (val - 0xd800u < 0x800) 
-		return;
-       	if (val < 0x10000) {
-		hbuf_putc(buf, 224 + val / 4096);
-		hbuf_putc(buf, 128 + val / 64 % 64);
-		hbuf_putc(buf, 128 + val % 64);
-		return;
-	}
-       	if (val < 0x110000) {
-		hbuf_putc(buf, 240 + val / 262144);
-		hbuf_putc(buf, 128 + val / 4096 % 64);
-		hbuf_putc(buf, 128 + val / 64 % 64);
-		hbuf_putc(buf, 128 + val % 64);
-		return;
-	}
-}
-
 static void
 rndr_stackpos_init(struct term *p, const struct lowdown_node *n)
 {
@@ -862,7 +838,8 @@ rndr_table(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 	struct term *p, const struct lowdown_node *n)
 {
 	size_t				*widths;
-	const struct lowdown_node	*row, *top, *cell;
+	const struct lowdown_node	*row, *top, *cell, *cur;
+	struct lowdown_node		*exp;
 	struct lowdown_buf		*celltmp, *rowtmp;
 	size_t				 col, i, j, maxcol, sz;
 	ssize_t			 	 last_blank;
@@ -887,8 +864,10 @@ rndr_table(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 			abort();
 		}
 
-		TAILQ_FOREACH(row, &top->children, entries)
-			TAILQ_FOREACH(cell, &row->children, entries) {
+		TAILQ_FOREACH(row, &top->children, entries) {
+			exp = table_row_expand(row);
+			cur = exp != NULL ? exp : row;
+			TAILQ_FOREACH(cell, &cur->children, entries) {
 				i = cell->rndr_table_cell.col;
 				assert(i < n->rndr_table.columns);
 				hbuf_truncate(celltmp);
@@ -914,6 +893,8 @@ rndr_table(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 				p->col = col;
 				p->maxcol = maxcol;
 			}
+			lowdown_node_free(exp);
+		}
 	}
 
 	/* Now actually print, row-by-row into the output. */
@@ -930,7 +911,9 @@ rndr_table(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 
 		TAILQ_FOREACH(row, &top->children, entries) {
 			hbuf_truncate(rowtmp);
-			TAILQ_FOREACH(cell, &row->children, entries) {
+			exp = table_row_expand(row);
+			cur = exp != NULL ? exp : row;
+			TAILQ_FOREACH(cell, &cur->children, entries) {
 				i = cell->rndr_table_cell.col;
 				hbuf_truncate(celltmp);
 				maxcol = p->maxcol;
@@ -977,6 +960,7 @@ rndr_table(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 				if (TAILQ_NEXT(cell, entries) != NULL)
 					HBUF_PUTSL(rowtmp, " | ");
 			}
+			lowdown_node_free(exp);
 
 			/* 
 			 * Some magic here.
@@ -1156,7 +1140,7 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 
 	/* Descend into children. */
 
-	TAILQ_FOREACH(child, &n->children, entries) {
+	TAILQ_FOREACH(child, lowdown_node_children(n), entries) {
 		p->stackpos++;
 		if (child->type == LOWDOWN_TABLE_BLOCK)
 			rndr_table(ob, mq, p, child);
@@ -1175,8 +1159,9 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		break;
 	case LOWDOWN_FOOTNOTE_REF:
 		hbuf_truncate(p->tmp);
-		hbuf_printf(p->tmp, "[%zu]", 
-			n->rndr_footnote_ref.num);
+		hbuf_putc(p->tmp, '[');
+		hbuf_putu(p->tmp, n->rndr_footnote_ref.num);
+		hbuf_putc(p->tmp, ']');
 		rndr_buf(p, ob, n, p->tmp, NULL);
 		break;
 	case LOWDOWN_RAW_HTML:
@@ -1189,7 +1174,7 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq,
 		entity = entity_find_iso(&n->rndr_entity.text);
 		if (entity > 0) {
 			hbuf_truncate(p->tmp);
-			rndr_entity(p->tmp, entity);
+			entity_utf8(p->tmp, entity);
 			rndr_buf(p, ob, n, p->tmp, NULL);
 		} else
 			rndr_buf(p, ob, n, &n->rndr_entity.text, 
@@ -1304,7 +1289,9 @@ lowdown_term_rndr(struct lowdown_buf *ob,
 	struct term	*p = arg;
 
 	p->stackpos = 0;
+	LOWDOWN_PROBE2(render__start, "term", n->id);
 	rndr(ob, mq, p, n);
+	LOWDOWN_PROBE2(render__done, "term", ob->size);
 }
 
 void *
@@ -609,6 +609,17 @@ main(void)
 	return 0;
 }
 #endif /* TEST_SYS_QUEUE */
+#if TEST_SYS_SDT_H
+#include <sys/sdt.h>
+
+int
+main(void)
+{
+	DTRACE_PROBE(lowdown, test);
+	DTRACE_PROBE2(lowdown, test2, 1, 2);
+	return 0;
+}
+#endif /* TEST_SYS_SDT_H */
 #if TEST_SYS_SYSMACROS_H
 #include <sys/sysmacros.h>
 
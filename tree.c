@@ -90,13 +90,15 @@ rndr_short(struct lowdown_buf *ob, const struct lowdown_buf *b)
 		HBUF_PUTSL(ob, "...");
 }
 
+/*
+ * Print one node and its attributes, but not its children.
+ */
 static void
-rndr(struct lowdown_buf *ob,
+rndr_node(struct lowdown_buf *ob,
 	const struct lowdown_node *root, size_t indent)
 {
-	const struct lowdown_node	*n;
-	struct lowdown_buf		*tmp;
 	size_t	 			 i, j;
+	struct lowdown_pos		 pos;
 
 	for (i = 0; i < indent; i++)
 		HBUF_PUTSL(ob, "  ");
@@ -295,11 +297,40 @@ rndr(struct lowdown_buf *ob,
 		break;
 	}
 
-	tmp = hbuf_new(64);
-	TAILQ_FOREACH(n, &root->children, entries)
-		rndr(tmp, n, indent + 1);
-	hbuf_putb(ob, tmp);
-	hbuf_free(tmp);
+	if (lowdown_node_pos(root, &pos)) {
+		for (i = 0; i < indent + 1; i++)
+			HBUF_PUTSL(ob, "  ");
+		hbuf_printf(ob, "position: lines %u-%u, bytes %u-%u\n",
+			pos.line, pos.line + pos.lines,
+			pos.off, pos.off + pos.len);
+	}
+}
+
+/*
+ * Print "root" and its descendants, indented by depth.
+ * Compact table rows have no children of their own, so they're
+ * replaced by their expansion.
+ */
+static void
+rndr(struct lowdown_buf *ob,
+	const struct lowdown_node *root, size_t indent)
+{
+	struct lowdown_iter	 it;
+	struct lowdown_node	*row;
+
+	lowdown_iter_init(&it, root);
+	while (lowdown_iter_next(&it) != LOWDOWN_ITER_DONE) {
+		if (it.event == LOWDOWN_ITER_LEAVE) {
+			indent--;
+			continue;
+		}
+		if ((row = table_row_expand(it.node)) != NULL) {
+			rndr(ob, row, indent);
+			lowdown_node_free(row);
+		} else
+			rndr_node(ob, it.node, indent);
+		indent++;
+	}
 }
 
 void
@@ -309,7 +340,9 @@ lowdown_tree_rndr(struct lowdown_buf *ob,
 {
 
 	assert(ref == NULL);
+	LOWDOWN_PROBE2(render__start, "tree", root->id);
 	rndr(ob, root, 0);
+	LOWDOWN_PROBE2(render__done, "tree", ob->size);
 }
 
 void *